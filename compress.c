@@ -64,7 +64,12 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <limits.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include <linux/types.h>
 #include <linux/ioctl.h>
@@ -76,49 +81,445 @@
 #include "sound/compress_offload.h"
 #include "tinycompress/tinycompress.h"
 #include "compress_ops.h"
+#include "compress_caps.h"
+#include "compress_pool.h"
+#include "compress_enum.h"
+#include "compress_feeder.h"
+#include "compress_trace.h"
 #include "snd_utils.h"
 
 #define COMPR_ERR_MAX 128
 
+/* Maximum number of iovec entries passed to the backend in one call */
+#define COMPR_IOV_MAX 64
+
 /* Default maximum time we will wait in a poll() - 20 seconds */
 #define DEFAULT_MAX_POLL_WAIT_MS    20000
 
+/* Longest poll() of the feeder thread, bounds its reaction to stop/close */
+#define FEEDER_MAX_POLL_WAIT_MS     100
+
+/* most threads compress_open_many() opens streams on */
+#define OPEN_MANY_MAX_THREADS       8
+
+/*
+ * Counters behind compress_get_stats(). The feeder thread updates them
+ * while the application reads them, so they are relaxed atomics.
+ */
+struct compress_counters {
+	atomic_ullong bytes_written;
+	atomic_ullong bytes_read;
+	atomic_ullong ioctls;
+	atomic_ullong writes;
+	atomic_ullong reads;
+	atomic_ullong polls;
+	atomic_ullong short_writes;
+	atomic_ullong short_reads;
+	atomic_ullong pause_exits;
+	atomic_ullong poll_timeouts;
+	atomic_ullong blocked_ns;
+	atomic_ullong max_stall_ns;
+};
+
+/* Latency histograms behind compress_get_histogram(), also lock-free */
+struct compress_histograms {
+	atomic_ullong count[COMPRESS_HIST_MAX][COMPRESS_HIST_BUCKETS];
+};
+
+/*
+ * When a transfer wakes up, see compress_update_marks(). Changed by the
+ * application only, the feeder thread works on a copy.
+ */
+struct compress_marks {
+	unsigned int avail_min;
+	unsigned int avail_reserve;
+	unsigned int bit_rate;
+	int max_poll_wait_ms;
+};
+
+/*
+ * Transfer state owned by the thread moving the data: the application,
+ * or the feeder thread of a COMPRESS_FEEDER stream. Other threads only
+ * make its avail estimate stale, through compress->avail_gen.
+ */
+struct compress_xfer {
+	/* where errors of the transfer are reported */
+	char *error;
+	const struct compress_marks *marks;
+	int avail_valid;
+	unsigned int avail_gen;
+	__u64 avail_estimate;
+};
+
 struct compress {
 	int fd;
 	unsigned int flags;
 	char error[COMPR_ERR_MAX];
+	unsigned int card;
+	unsigned int device;
 	struct compr_config *config;
+	/* config->codec points here, the caller's codec is copied */
+	struct snd_codec codec;
+	/* SET_PARAMS deferred to the first transfer or start */
+	int params_pending;
 	int running;
-	int max_poll_wait_ms;
+	/* the stream left the configured state without being started */
+	int setup_dirty;
+	/* codec parameters differ from the ones given at open */
+	int codec_changed;
 	int nonblocking;
 	unsigned int gapless_metadata;
 	unsigned int next_track;
 
-	struct compress_ops *ops;
+	/*
+	 * transfer once avail reaches avail_min, leaving avail_reserve
+	 * untouched, derived from the watermarks
+	 */
+	unsigned int low_mark;
+	unsigned int high_mark;
+	struct compress_marks marks;
+	/* held to change marks and by the feeder thread to copy them */
+	pthread_mutex_t marks_lock;
+	atomic_ulong wakeups;
+	atomic_ullong wakeup_start_ns;
+
+	int avail_accounting;
+	/* bumped to make the avail estimate of every transfer stale */
+	atomic_uint avail_gen;
+	atomic_ulong avail_queried;
+	atomic_ulong avail_avoided;
+	struct compress_xfer xfer;
+
+	char *staging;
+	unsigned int staging_size;
+	unsigned int staged;
+	/* handed out by the plugin ring, what the next commit may fill */
+	size_t ring_acquired;
+
+	struct compress_feeder *feeder;
+	struct compr_feeder_config feeder_config;
+	size_t feeder_acquired;
+	/* only used by the feeder thread, its errors go back as errno */
+	struct compress_xfer feeder_xfer;
+	struct compress_marks feeder_marks;
+	char feeder_error[COMPR_ERR_MAX];
+
+	struct compress_counters stats;
+	struct compress_histograms hist;
+#ifdef COMPRESS_TRACE
+	char trace_id[COMPRESS_TRACE_ID_MAX];
+#endif
+
+	const struct compress_ops *ops;
 	void *data;
 	void *snd_node;
 };
 
-extern struct compress_ops compr_hw_ops;
-extern struct compress_ops compr_plug_ops;
+#ifdef COMPRESS_HW_ONLY
+/*
+ * Kernel devices only: the hw backend is built in this file so that calls
+ * through its constant ops table are resolved, and inlined, at compile
+ * time. There is no card definition or plugin lookup.
+ */
+#include "compress_hw.c"
+#define COMPRESS_OPS(compress)	(&compr_hw_ops)
+#else
+extern const struct compress_ops compr_hw_ops;
+extern const struct compress_ops compr_plug_ops;
+extern const struct compress_ops compr_uring_ops;
+#define COMPRESS_OPS(compress)	((compress)->ops)
+#endif
 
-static int oops(struct compress *compress, int e, const char *fmt, ...)
+/* Pick the backend of a device from its card definition node and flags */
+static const struct compress_ops *compress_select_ops(struct snd_node *node,
+		unsigned int flags)
+{
+#ifdef COMPRESS_HW_ONLY
+	return &compr_hw_ops;
+#else
+	if (snd_utils_get_node_type(node) == SND_NODE_TYPE_PLUGIN)
+		return &compr_plug_ops;
+	if (flags & COMPRESS_URING)
+		return &compr_uring_ops;
+	return &compr_hw_ops;
+#endif
+}
+
+static int compress_verror(char *error, int e, const char *fmt, va_list ap)
 {
-	va_list ap;
 	int sz;
 
-	va_start(ap, fmt);
-	vsnprintf(compress->error, COMPR_ERR_MAX, fmt, ap);
-	va_end(ap);
-	sz = strlen(compress->error);
+	vsnprintf(error, COMPR_ERR_MAX, fmt, ap);
+	sz = strlen(error);
 
-	snprintf(compress->error + sz, COMPR_ERR_MAX - sz,
+	snprintf(error + sz, COMPR_ERR_MAX - sz,
 		": %s", strerror(e));
 	errno = e;
 
 	return -1;
 }
 
+static int oops(struct compress *compress, int e, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = compress_verror(compress->error, e, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/* oops() for the thread owning xfer */
+static int xfer_oops(struct compress_xfer *xfer, int e, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = compress_verror(xfer->error, e, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+static inline void compress_stat_add(atomic_ullong *counter,
+		unsigned long long val)
+{
+	atomic_fetch_add_explicit(counter, val, memory_order_relaxed);
+}
+
+static unsigned long long compress_elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000ULL +
+		now.tv_nsec - start->tv_nsec;
+}
+
+/* bucket 0 is below 1us, bucket i covers [2^(i-1), 2^i) us */
+static void compress_hist_record(struct compress *compress,
+		enum compress_hist_type type, unsigned long long ns)
+{
+	unsigned long long us = ns / 1000;
+	unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+	if (bucket >= COMPRESS_HIST_BUCKETS)
+		bucket = COMPRESS_HIST_BUCKETS - 1;
+	compress_stat_add(&compress->hist.count[type][bucket], 1);
+}
+
+static void compress_stat_stall(struct compress *compress,
+		unsigned long long ns)
+{
+	unsigned long long max;
+
+	compress_stat_add(&compress->stats.blocked_ns, ns);
+	max = atomic_load_explicit(&compress->stats.max_stall_ns,
+			memory_order_relaxed);
+	while ((ns > max) &&
+	       !atomic_compare_exchange_weak_explicit(&compress->stats.max_stall_ns,
+			&max, ns, memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+#ifdef COMPRESS_TRACE
+static const char *compress_ioctl_name(unsigned int cmd)
+{
+	switch (cmd) {
+	case SNDRV_COMPRESS_IOCTL_VERSION:
+		return "compress_ioctl VERSION";
+	case SNDRV_COMPRESS_GET_CAPS:
+		return "compress_ioctl GET_CAPS";
+	case SNDRV_COMPRESS_GET_CODEC_CAPS:
+		return "compress_ioctl GET_CODEC_CAPS";
+	case SNDRV_COMPRESS_SET_PARAMS:
+		return "compress_ioctl SET_PARAMS";
+	case SNDRV_COMPRESS_GET_PARAMS:
+		return "compress_ioctl GET_PARAMS";
+	case SNDRV_COMPRESS_SET_METADATA:
+		return "compress_ioctl SET_METADATA";
+	case SNDRV_COMPRESS_GET_METADATA:
+		return "compress_ioctl GET_METADATA";
+	case SNDRV_COMPRESS_TSTAMP:
+		return "compress_ioctl TSTAMP";
+	case SNDRV_COMPRESS_AVAIL:
+		return "compress_ioctl AVAIL";
+	case SNDRV_COMPRESS_PAUSE:
+		return "compress_ioctl PAUSE";
+	case SNDRV_COMPRESS_RESUME:
+		return "compress_ioctl RESUME";
+	case SNDRV_COMPRESS_START:
+		return "compress_ioctl START";
+	case SNDRV_COMPRESS_STOP:
+		return "compress_ioctl STOP";
+	case SNDRV_COMPRESS_DRAIN:
+		return "compress_ioctl DRAIN";
+	case SNDRV_COMPRESS_NEXT_TRACK:
+		return "compress_ioctl NEXT_TRACK";
+	case SNDRV_COMPRESS_PARTIAL_DRAIN:
+		return "compress_ioctl PARTIAL_DRAIN";
+	default:
+		return "compress_ioctl";
+	}
+}
+#endif
+
+static int compress_ioctl(struct compress *compress, unsigned int cmd,
+		void *arg)
+{
+	int ret;
+
+	compress_stat_add(&compress->stats.ioctls, 1);
+	compress_trace_begin(compress->trace_id, compress_ioctl_name(cmd));
+	ret = COMPRESS_OPS(compress)->ioctl(compress->data, cmd, arg);
+	compress_trace_end();
+	return ret;
+}
+
+/*
+ * Typed versions of compress_ioctl() for the commands on the hot path,
+ * they skip the variadic dispatch of the backends.
+ */
+static int compress_ops_avail(struct compress *compress,
+		struct snd_compr_avail *avail)
+{
+	struct timespec start;
+	int ret, err;
+
+	compress_stat_add(&compress->stats.ioctls, 1);
+	compress_trace_begin(compress->trace_id, "compress_ioctl AVAIL");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = COMPRESS_OPS(compress)->avail(compress->data, avail);
+	err = errno;
+	compress_trace_end();
+	compress_hist_record(compress, COMPRESS_HIST_AVAIL,
+			compress_elapsed_ns(&start));
+	errno = err;
+	return ret;
+}
+
+static int compress_ops_tstamp(struct compress *compress,
+		struct snd_compr_tstamp *tstamp)
+{
+	int ret;
+
+	compress_stat_add(&compress->stats.ioctls, 1);
+	compress_trace_begin(compress->trace_id, "compress_ioctl TSTAMP");
+	ret = COMPRESS_OPS(compress)->tstamp(compress->data, tstamp);
+	compress_trace_end();
+	return ret;
+}
+
+static int compress_ops_tstamp64(struct compress *compress,
+		struct compress_plugin_tstamp64 *tstamp)
+{
+	struct snd_compr_tstamp tstamp32;
+	int ret;
+
+	if (!COMPRESS_OPS(compress)->tstamp64) {
+		ret = compress_ops_tstamp(compress, &tstamp32);
+		if (ret)
+			return ret;
+		tstamp->byte_offset = tstamp32.byte_offset;
+		tstamp->copied_total = tstamp32.copied_total;
+		tstamp->pcm_frames = tstamp32.pcm_frames;
+		tstamp->pcm_io_frames = tstamp32.pcm_io_frames;
+		tstamp->sampling_rate = tstamp32.sampling_rate;
+		return 0;
+	}
+
+	compress_stat_add(&compress->stats.ioctls, 1);
+	compress_trace_begin(compress->trace_id, "compress_ioctl TSTAMP");
+	ret = COMPRESS_OPS(compress)->tstamp64(compress->data, tstamp);
+	compress_trace_end();
+	return ret;
+}
+
+static int compress_ops_set_metadata(struct compress *compress,
+		struct snd_compr_metadata *metadata, unsigned int count)
+{
+	unsigned int i;
+	int ret;
+
+	if (!COMPRESS_OPS(compress)->set_metadata) {
+		for (i = 0; i < count; i++) {
+			if (compress_ioctl(compress, SNDRV_COMPRESS_SET_METADATA,
+						&metadata[i]))
+				return -1;
+		}
+		return 0;
+	}
+
+	compress_stat_add(&compress->stats.ioctls, 1);
+	compress_trace_begin(compress->trace_id, "compress_ioctl SET_METADATA");
+	ret = COMPRESS_OPS(compress)->set_metadata(compress->data, metadata,
+			count);
+	compress_trace_end();
+	return ret;
+}
+
+static int compress_ops_start(struct compress *compress)
+{
+	int ret;
+
+	compress_stat_add(&compress->stats.ioctls, 1);
+	compress_trace_begin(compress->trace_id, "compress_ioctl START");
+	ret = COMPRESS_OPS(compress)->start(compress->data);
+	compress_trace_end();
+	return ret;
+}
+
+static int compress_ops_stop(struct compress *compress)
+{
+	int ret;
+
+	compress_stat_add(&compress->stats.ioctls, 1);
+	compress_trace_begin(compress->trace_id, "compress_ioctl STOP");
+	ret = COMPRESS_OPS(compress)->stop(compress->data);
+	compress_trace_end();
+	return ret;
+}
+
+static int compress_ops_set_params(struct compress *compress,
+		struct snd_compr_params *params)
+{
+	int ret;
+
+	compress_stat_add(&compress->stats.ioctls, 1);
+	compress_trace_begin(compress->trace_id, "compress_ioctl SET_PARAMS");
+	ret = COMPRESS_OPS(compress)->set_params(compress->data, params);
+	compress_trace_end();
+	return ret;
+}
+
+static int compress_poll(struct compress *compress, struct pollfd *fds,
+		int timeout_ms)
+{
+	struct timespec start;
+	unsigned long long ns;
+	int ret, err;
+
+	compress_trace_begin(compress->trace_id, "compress_poll");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = COMPRESS_OPS(compress)->poll(compress->data, fds, 1, timeout_ms);
+	err = errno;
+	compress_trace_end();
+
+	ns = compress_elapsed_ns(&start);
+	compress_stat_add(&compress->stats.polls, 1);
+	compress_stat_stall(compress, ns);
+	compress_hist_record(compress, COMPRESS_HIST_POLL_WAIT, ns);
+	/* a sleep to the wakeup mark is meant to time out */
+	if ((ret == 0) && fds->events)
+		compress_stat_add(&compress->stats.poll_timeouts, 1);
+
+	errno = err;
+	return ret;
+}
+
 const char *compress_get_error(struct compress *compress)
 {
 	return compress->error;
@@ -141,36 +542,422 @@ static int get_compress_version(struct compress *compress)
 {
 	int version = 0;
 
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_IOCTL_VERSION, &version)) {
+	if (compress_ioctl(compress, SNDRV_COMPRESS_IOCTL_VERSION, &version)) {
 		oops(compress, errno, "cant read version");
 		return -1;
 	}
 	return version;
 }
 
-static bool _is_codec_type_supported(struct compress_ops *ops, void *data,
+static bool _is_codec_type_supported(struct snd_compr_caps *caps,
 		struct snd_codec *codec)
 {
-	struct snd_compr_caps caps;
 	bool found = false;
 	unsigned int i;
 
-	if (ops->ioctl(data, SNDRV_COMPRESS_GET_CAPS, &caps)) {
-		oops(&bad_compress, errno, "cannot get device caps");
-		return false;
-	}
-
-	for (i = 0; i < caps.num_codecs; i++) {
-		if (caps.codecs[i] == codec->id) {
+	for (i = 0; i < caps->num_codecs; i++) {
+		if (caps->codecs[i] == codec->id) {
 			/* found the codec */
 			found = true;
 			break;
 		}
 	}
-	/* TODO: match the codec properties */
 	return found;
 }
 
+static void compress_desc_bit_rates(const struct snd_codec_desc *desc,
+		unsigned int *min, unsigned int *max)
+{
+	unsigned int i, num = desc->num_bitrates;
+
+	if (num > MAX_NUM_BITRATES)
+		num = MAX_NUM_BITRATES;
+
+	*min = UINT_MAX;
+	*max = 0;
+	for (i = 0; i < num; i++) {
+		if (desc->bit_rate[i] < *min)
+			*min = desc->bit_rate[i];
+		if (desc->bit_rate[i] > *max)
+			*max = desc->bit_rate[i];
+	}
+}
+
+/* Cost of changing a property, relative to its value in per mille */
+static unsigned int compress_fit_cost(unsigned int from, unsigned int to)
+{
+	unsigned long long delta = from > to ? from - to : to - from;
+
+	return delta * 1000 / from + 1;
+}
+
+/*
+ * Fit codec into a descriptor, returns the cost of the properties that
+ * had to change, 0 when the descriptor supports it as it is. Bit rates
+ * are taken as the range of the listed ones. Unset fields on either side
+ * don't restrict the match, the descriptors carry nothing to check the
+ * level against.
+ */
+static unsigned int compress_desc_fit(const struct snd_codec_desc *desc,
+		struct snd_codec *codec)
+{
+	unsigned int i, num, min, max, best, cost = 0;
+
+	if (desc->max_ch && (codec->ch_in > desc->max_ch)) {
+		cost += compress_fit_cost(codec->ch_in, desc->max_ch);
+		codec->ch_in = desc->max_ch;
+		if (codec->ch_out > desc->max_ch)
+			codec->ch_out = desc->max_ch;
+	}
+
+	num = desc->num_sample_rates;
+	if (num > MAX_NUM_SAMPLE_RATES)
+		num = MAX_NUM_SAMPLE_RATES;
+	if (num && codec->sample_rate) {
+		best = desc->sample_rates[0];
+		for (i = 0; i < num; i++) {
+			if (desc->sample_rates[i] == codec->sample_rate)
+				break;
+			/* closest rate, the higher one on a tie */
+			if ((abs((int)(desc->sample_rates[i] - codec->sample_rate)) <
+			     abs((int)(best - codec->sample_rate))) ||
+			    ((abs((int)(desc->sample_rates[i] - codec->sample_rate)) ==
+			      abs((int)(best - codec->sample_rate))) &&
+			     (desc->sample_rates[i] > best)))
+				best = desc->sample_rates[i];
+		}
+		if (i == num) {
+			cost += compress_fit_cost(codec->sample_rate, best);
+			codec->sample_rate = best;
+		}
+	}
+
+	if (desc->num_bitrates && codec->bit_rate) {
+		compress_desc_bit_rates(desc, &min, &max);
+		if (codec->bit_rate < min) {
+			cost += compress_fit_cost(codec->bit_rate, min);
+			codec->bit_rate = min;
+		} else if (codec->bit_rate > max) {
+			cost += compress_fit_cost(codec->bit_rate, max);
+			codec->bit_rate = max;
+		}
+	}
+
+	/* a different profile or format counts as doubling a value */
+	if (desc->profiles && codec->profile &&
+	    !(desc->profiles & codec->profile)) {
+		codec->profile = desc->profiles & -desc->profiles;
+		cost += 1000;
+	}
+
+	if (desc->formats && codec->format &&
+	    !(desc->formats & codec->format)) {
+		codec->format = desc->formats & -desc->formats;
+		cost += 1000;
+	}
+
+	return cost;
+}
+
+/*
+ * Match the codec type and, when the driver reports codec descriptors,
+ * its properties against at least one of them
+ */
+static bool _is_codec_supported(struct snd_compr_caps *caps,
+		struct snd_compr_codec_caps *codec_caps, struct snd_codec *codec)
+{
+	struct snd_codec fit;
+	unsigned int i;
+
+	if (!_is_codec_type_supported(caps, codec))
+		return false;
+	if (!codec_caps || !codec_caps->num_descriptors)
+		return true;
+
+	for (i = 0; i < codec_caps->num_descriptors; i++) {
+		fit = *codec;
+		if (!compress_desc_fit(&codec_caps->descriptor[i], &fit))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Get the descriptors of a supported codec from the cache or the device,
+ * returns false when the driver doesn't report them
+ */
+static bool compress_get_codec_caps(const struct compress_ops *ops, void *data,
+		unsigned int card, unsigned int device, unsigned int flags,
+		struct snd_compr_caps *caps, unsigned int codec_id,
+		struct snd_compr_codec_caps *codec_caps)
+{
+	struct snd_codec codec = { .id = codec_id };
+	int ret;
+
+	ret = compress_codec_caps_lookup(card, device, flags, codec_id,
+			codec_caps);
+	if (ret != -ENOENT)
+		return !ret;
+	if (!_is_codec_type_supported(caps, &codec))
+		return false;
+
+	memset(codec_caps, 0, sizeof(*codec_caps));
+	codec_caps->codec = codec_id;
+	if (ops->ioctl(data, SNDRV_COMPRESS_GET_CODEC_CAPS, codec_caps)) {
+		compress_codec_caps_store(card, device, flags, codec_id, NULL);
+		return false;
+	}
+	if (codec_caps->num_descriptors > MAX_NUM_CODEC_DESCRIPTORS)
+		codec_caps->num_descriptors = MAX_NUM_CODEC_DESCRIPTORS;
+
+	compress_codec_caps_store(card, device, flags, codec_id, codec_caps);
+	return true;
+}
+
+/*
+ * Get the caps of a device and the descriptors of one of its codecs,
+ * answered from the cache when possible. Sets reported to whether the
+ * driver reports codec descriptors.
+ */
+static int compress_get_device_caps(unsigned int card, unsigned int device,
+		unsigned int flags, unsigned int codec_id,
+		struct snd_compr_caps *caps,
+		struct snd_compr_codec_caps *codec_caps, bool *reported)
+{
+	struct snd_codec codec = { .id = codec_id };
+	const struct compress_ops *ops;
+	void *snd_node, *data;
+	int fd, ret;
+
+	if (!compress_caps_lookup(card, device, flags, caps)) {
+		/* the callers answer an unknown codec from the caps alone */
+		if (!_is_codec_type_supported(caps, &codec)) {
+			*reported = false;
+			return 0;
+		}
+		ret = compress_codec_caps_lookup(card, device, flags, codec_id,
+				codec_caps);
+		if (ret != -ENOENT) {
+			*reported = !ret;
+			return 0;
+		}
+	}
+
+	snd_node = snd_utils_get_dev_node(card, device, NODE_COMPRESS);
+	ops = compress_select_ops(snd_node, flags & ~COMPRESS_URING);
+
+	fd = ops->open(card, device, flags, &data, snd_node);
+	if (fd < 0) {
+		oops(&bad_compress, errno, "cannot open card %u, device %u",
+					card, device);
+		snd_utils_put_dev_node(snd_node);
+		return -1;
+	}
+
+	ret = 0;
+	if (compress_caps_lookup(card, device, flags, caps)) {
+		if (ops->ioctl(data, SNDRV_COMPRESS_GET_CAPS, caps)) {
+			ret = oops(&bad_compress, errno, "cannot get device caps");
+			goto out;
+		}
+		compress_caps_store(card, device, flags, caps);
+	}
+	*reported = compress_get_codec_caps(ops, data, card, device, flags,
+			caps, codec_id, codec_caps);
+
+out:
+	snd_utils_put_dev_node(snd_node);
+	ops->close(data);
+	return ret;
+}
+
+int compress_enum_query_device(unsigned int card, unsigned int device,
+		unsigned int flags, struct snd_compr_caps *caps, bool *plugin)
+{
+	struct snd_compr_codec_caps codec_caps;
+	const struct compress_ops *ops;
+	void *snd_node, *data;
+	unsigned int i;
+	int fd, ret = 0;
+
+	snd_node = snd_utils_get_dev_node(card, device, NODE_COMPRESS);
+	*plugin = snd_utils_get_node_type(snd_node) == SND_NODE_TYPE_PLUGIN;
+	ops = compress_select_ops(snd_node, flags & ~COMPRESS_URING);
+
+	fd = ops->open(card, device, flags, &data, snd_node);
+	if (fd < 0) {
+		ret = -errno;
+		snd_utils_put_dev_node(snd_node);
+		return ret;
+	}
+
+	if (ops->ioctl(data, SNDRV_COMPRESS_GET_CAPS, caps)) {
+		ret = -errno;
+		goto out;
+	}
+	if (caps->num_codecs > MAX_NUM_CODECS)
+		caps->num_codecs = MAX_NUM_CODECS;
+	compress_caps_store(card, device, flags, caps);
+
+	/* fill the descriptor cache while the device is open */
+	for (i = 0; i < caps->num_codecs; i++)
+		compress_get_codec_caps(ops, data, card, device, flags, caps,
+				caps->codecs[i], &codec_caps);
+
+out:
+	snd_utils_put_dev_node(snd_node);
+	ops->close(data);
+	return ret;
+}
+
+/*
+ * Get the avail for the next transfer of size bytes. With avail accounting
+ * enabled the last queried value, minus what was transferred since, is used
+ * as long as it still allows the transfer. The DSP can only grow avail
+ * between two queries, so the estimate never exceeds the real value.
+ */
+static void compress_set_avail(struct compress *compress,
+		struct compress_xfer *xfer, unsigned int gen, __u64 avail)
+{
+	atomic_fetch_add_explicit(&compress->avail_queried, 1,
+			memory_order_relaxed);
+	xfer->avail_estimate = avail;
+	xfer->avail_gen = gen;
+	xfer->avail_valid = 1;
+}
+
+static int compress_get_avail(struct compress *compress,
+		struct compress_xfer *xfer, struct snd_compr_avail *avail,
+		unsigned int size)
+{
+	unsigned int gen = atomic_load_explicit(&compress->avail_gen,
+			memory_order_acquire);
+
+	if (compress->avail_accounting && xfer->avail_valid &&
+	    (xfer->avail_gen == gen) &&
+	    ((xfer->avail_estimate >= xfer->marks->avail_min) ||
+	     (xfer->avail_estimate >= (__u64)size + xfer->marks->avail_reserve))) {
+		avail->avail = xfer->avail_estimate;
+		atomic_fetch_add_explicit(&compress->avail_avoided, 1,
+				memory_order_relaxed);
+		return 0;
+	}
+
+	/* sampled before the query, an invalidation meanwhile wins */
+	if (compress_ops_avail(compress, avail))
+		return -1;
+
+	compress_set_avail(compress, xfer, gen, avail->avail);
+	return 0;
+}
+
+static void compress_consume_avail(struct compress_xfer *xfer,
+		unsigned int requested, unsigned int done)
+{
+	/* a short transfer means our estimate was off, query again */
+	if ((done < requested) || (done > xfer->avail_estimate))
+		xfer->avail_valid = 0;
+	else
+		xfer->avail_estimate -= done;
+}
+
+/* Any thread: the avail estimates are re-queried before the next use */
+static inline void compress_invalidate_avail(struct compress *compress)
+{
+	atomic_fetch_add_explicit(&compress->avail_gen, 1,
+			memory_order_release);
+}
+
+static void compress_set_bit_rate(struct compress *compress,
+		unsigned int bit_rate)
+{
+	pthread_mutex_lock(&compress->marks_lock);
+	compress->marks.bit_rate = bit_rate;
+	pthread_mutex_unlock(&compress->marks_lock);
+}
+
+/*
+ * Playback refills when the buffered data drops to the low mark and
+ * tops it up to the high mark. Capture reads once the buffered data
+ * reaches the high mark and leaves the low mark in the buffer. Without
+ * marks this is one fragment, like the driver wakeups.
+ */
+static void compress_update_marks(struct compress *compress)
+{
+	const unsigned int frag_size = compress->config->fragment_size;
+	const unsigned int buffer_size = frag_size * compress->config->fragments;
+	unsigned int low = compress->low_mark, high = compress->high_mark;
+	unsigned int avail_min, avail_reserve;
+
+	if (compress->flags & COMPRESS_IN) {
+		if (!high) {
+			low = buffer_size - frag_size;
+			high = buffer_size;
+		}
+		avail_min = buffer_size - low;
+		avail_reserve = buffer_size - high;
+	} else {
+		if (!high) {
+			low = 0;
+			high = frag_size;
+		}
+		avail_min = high;
+		avail_reserve = low;
+	}
+
+	/* the feeder thread must not see half of the update */
+	pthread_mutex_lock(&compress->marks_lock);
+	compress->marks.avail_min = avail_min;
+	compress->marks.avail_reserve = avail_reserve;
+	pthread_mutex_unlock(&compress->marks_lock);
+	compress_invalidate_avail(compress);
+}
+
+static inline __u64 compress_usable(const struct compress_marks *marks,
+		__u64 avail)
+{
+	return avail > marks->avail_reserve ? avail - marks->avail_reserve : 0;
+}
+
+static void compress_count_wakeup(struct compress *compress)
+{
+	struct timespec now;
+
+	if (atomic_fetch_add_explicit(&compress->wakeups, 1,
+				memory_order_relaxed))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	atomic_store_explicit(&compress->wakeup_start_ns,
+			now.tv_sec * 1000000000ULL + now.tv_nsec,
+			memory_order_relaxed);
+}
+
+/*
+ * The driver signals poll() once per fragment. When the wakeup mark is
+ * further away than that, the transfer sleeps on the poll fd with no
+ * events for the time the DSP needs to get there, so stop, errors and
+ * pauses still end the wait. Returns that time bounded by the poll wait
+ * budget, 0 once the budget is used up.
+ */
+static int compress_mark_timeout(const struct compress_marks *marks,
+		__u64 avail, int *budget_ms)
+{
+	__u64 ms;
+
+	ms = (marks->avail_min - avail) * 8000ULL / marks->bit_rate;
+	if (!ms)
+		ms = 1;
+	if (*budget_ms >= 0) {
+		if (ms > (__u64)*budget_ms)
+			ms = *budget_ms;
+		*budget_ms -= ms;
+	} else if (ms > INT_MAX) {
+		ms = INT_MAX;
+	}
+	return ms;
+}
+
 static inline void
 fill_compress_params(struct compr_config *config, struct snd_compr_params *params)
 {
@@ -179,15 +966,154 @@ fill_compress_params(struct compr_config *config, struct snd_compr_params *param
 	memcpy(&params->codec, config->codec, sizeof(params->codec));
 }
 
-struct compress *compress_open(unsigned int card, unsigned int device,
-		unsigned int flags, struct compr_config *config)
+static unsigned int compress_clamp(__u64 val, unsigned int min,
+		unsigned int max)
+{
+	if (val < min)
+		return min;
+	return val > max ? max : val;
+}
+
+/*
+ * Size the ring from the latency targets of the caller within the driver
+ * limits. Interactive streams get the fewest and smallest fragments, deep
+ * buffer streams the most and largest, anything in between is converted
+ * from milliseconds at the codec bit rate.
+ */
+static int compress_fit_latency(const struct snd_compr_caps *caps,
+		struct compr_config *config, struct compr_latency *latency)
+{
+	const __u64 bit_rate = config->codec->bit_rate;
+	unsigned int min_frags, max_frags;
+	__u64 frag, buffer;
+
+	max_frags = caps->max_fragments ? caps->max_fragments : 1;
+	min_frags = compress_clamp(2, caps->min_fragments, max_frags);
+
+	if ((latency->wakeup_ms ||
+	     (latency->buffer_ms &&
+	      latency->buffer_ms != COMPRESS_LATENCY_DEEP_BUFFER)) &&
+	    !bit_rate)
+		return -EINVAL;
+
+	if (latency->wakeup_ms)
+		frag = latency->wakeup_ms * bit_rate / 8000;
+	else if (!latency->buffer_ms)
+		frag = caps->min_fragment_size;
+	else if (latency->buffer_ms == COMPRESS_LATENCY_DEEP_BUFFER)
+		frag = caps->max_fragment_size;
+	else
+		/* a quarter of the buffer leaves room to refill in time */
+		frag = latency->buffer_ms * bit_rate / 8000 / 4;
+	config->fragment_size = compress_clamp(frag, caps->min_fragment_size,
+			caps->max_fragment_size);
+
+	if (!latency->buffer_ms) {
+		config->fragments = min_frags;
+	} else if (latency->buffer_ms == COMPRESS_LATENCY_DEEP_BUFFER) {
+		config->fragments = max_frags;
+	} else {
+		buffer = latency->buffer_ms * bit_rate / 8000;
+		config->fragments = compress_clamp(
+				(buffer + config->fragment_size - 1) /
+				config->fragment_size, min_frags, max_frags);
+	}
+
+	return 0;
+}
+
+/*
+ * Check config against the device caps and keep it for SET_PARAMS, filling
+ * in the fragment config the caller left to us. Errors are reported on err.
+ */
+static int compress_setup(struct compress *compress, struct compress *err,
+		struct compr_config *config, struct compr_latency *latency)
 {
-	struct compress *compress;
-	struct snd_compr_params params;
 	struct snd_compr_caps caps;
-	int compress_type;
+	unsigned int card = compress->card, device = compress->device;
+	unsigned int flags = compress->flags;
+
+	if (!config->codec)
+		return oops(err, EINVAL, "passed bad config");
+
+	if (compress_caps_lookup(card, device, flags, &caps)) {
+		if (compress_ioctl(compress, SNDRV_COMPRESS_GET_CAPS, &caps))
+			return oops(err, errno, "cannot get device caps");
+		compress_caps_store(card, device, flags, &caps);
+	}
+
+	if (latency) {
+		if (compress_fit_latency(&caps, config, latency))
+			return oops(err, EINVAL,
+				"latency targets need a codec bit rate");
+	} else if ((config->fragment_size == 0) || (config->fragments == 0)) {
+		/* If caller passed "don't care" fill in default values */
+		config->fragment_size = caps.min_fragment_size;
+		config->fragments = caps.max_fragments;
+	}
 
-	if (!config) {
+	/* drivers listing no codecs at all are not checked */
+	if (caps.num_codecs) {
+		struct snd_compr_codec_caps codec_caps;
+		bool reported;
+
+		reported = compress_get_codec_caps(compress->ops, compress->data,
+				card, device, flags, &caps, config->codec->id,
+				&codec_caps);
+		if (!_is_codec_supported(&caps, reported ? &codec_caps : NULL,
+					config->codec))
+			return oops(err, EINVAL, "codec not supported");
+	}
+
+	memcpy(compress->config, config, sizeof(*compress->config));
+	compress->codec = *config->codec;
+	compress->config->codec = &compress->codec;
+	compress_set_bit_rate(compress, compress->codec.bit_rate);
+	compress_update_marks(compress);
+
+	if (latency)
+		latency->buffered_ms = compress->marks.bit_rate ?
+			(__u64)config->fragment_size * config->fragments *
+			8000 / compress->marks.bit_rate : 0;
+	return 0;
+}
+
+/* Send the kept config to the driver, once, errors are reported on err */
+static int compress_apply_params(struct compress *compress,
+		struct compress *err)
+{
+	struct snd_compr_params params;
+
+	if (!compress->params_pending)
+		return 0;
+	if (!compress->config->codec)
+		return oops(err, EINVAL, "stream not configured");
+
+	fill_compress_params(compress->config, &params);
+	if (compress_ops_set_params(compress, &params))
+		return oops(err, errno, "cannot set device");
+
+	compress->params_pending = 0;
+	return 0;
+}
+
+/* AVAIL remains an ioctl with io_uring, skip it when we can */
+static int compress_default_avail_accounting(struct compress *compress)
+{
+#ifndef COMPRESS_HW_ONLY
+	if (compress->ops == &compr_uring_ops)
+		return 1;
+#endif
+	return 0;
+}
+
+static struct compress *_compress_open(unsigned int card,
+		unsigned int device, unsigned int flags,
+		struct compr_config *config, struct compr_latency *latency)
+{
+	struct compress *compress;
+
+	if (!config && !(flags & COMPRESS_DEFER_PARAMS)) {
 		oops(&bad_compress, EINVAL, "passed bad config");
 		return &bad_compress;
 	}
@@ -198,87 +1124,237 @@ struct compress *compress_open(unsigned int card, unsigned int device,
 		return &bad_compress;
 	}
 
+	compress_trace_set_id(compress->trace_id, card, device);
+	pthread_mutex_init(&compress->marks_lock, NULL);
+	compress->xfer.error = compress->error;
+	compress->xfer.marks = &compress->marks;
+	compress->feeder_xfer.error = compress->feeder_error;
+	compress->feeder_xfer.marks = &compress->feeder_marks;
+	compress->card = card;
+	compress->device = device;
+	compress->params_pending = 1;
 	compress->next_track = 0;
 	compress->gapless_metadata = 0;
 	compress->config = calloc(1, sizeof(*config));
 	if (!compress->config)
 		goto input_fail;
 
-	compress->max_poll_wait_ms = DEFAULT_MAX_POLL_WAIT_MS;
+	compress->marks.max_poll_wait_ms = DEFAULT_MAX_POLL_WAIT_MS;
 
 	compress->flags = flags;
 	if (!((flags & COMPRESS_OUT) || (flags & COMPRESS_IN))) {
 		oops(&bad_compress, EINVAL, "can't deduce device direction from given flags");
 		goto config_fail;
 	}
+	if ((flags & COMPRESS_FEEDER) && !(flags & COMPRESS_IN)) {
+		oops(&bad_compress, EINVAL, "feeder is only supported for playback");
+		goto config_fail;
+	}
+	compress->feeder_config.sched_policy = SCHED_OTHER;
+	compress->feeder_config.cpu = -1;
 
 	compress->snd_node = snd_utils_get_dev_node(card, device, NODE_COMPRESS);
-	compress_type = snd_utils_get_node_type(compress->snd_node);
-	if (compress_type == SND_NODE_TYPE_PLUGIN)
-		compress->ops = &compr_plug_ops;
-	else
-		compress->ops = &compr_hw_ops;
+	compress->ops = compress_select_ops(compress->snd_node, flags);
 
-	compress->fd = compress->ops->open(card, device, flags,
+	compress->fd = COMPRESS_OPS(compress)->open(card, device, flags,
 									   &compress->data, compress->snd_node);
+#ifndef COMPRESS_HW_ONLY
+	/* io_uring unavailable or restricted, use the classic backend */
+	if ((compress->fd < 0) && (compress->ops == &compr_uring_ops)) {
+		compress->ops = &compr_hw_ops;
+		compress->fd = COMPRESS_OPS(compress)->open(card, device, flags,
+				&compress->data, compress->snd_node);
+	}
+#endif
 	if (compress->fd < 0) {
 		oops(&bad_compress, errno, "cannot open card(%u) device(%u)",
 			card, device);
 		goto config_fail;
 	}
+	compress->avail_accounting = compress_default_avail_accounting(compress);
 
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_GET_CAPS, &caps)) {
-		oops(compress, errno, "cannot get device caps");
-		goto codec_fail;
-	}
-
-	/* If caller passed "don't care" fill in default values */
-	if ((config->fragment_size == 0) || (config->fragments == 0)) {
-		config->fragment_size = caps.min_fragment_size;
-		config->fragments = caps.max_fragments;
-	}
-
-#if 0
-	/* FIXME need to turn this On when DSP supports
-	 * and treat in no support case
-	 */
-	if (_is_codec_supported(compress, config, &caps) == false) {
-		oops(compress, errno, "codec not supported\n");
+	if (config && compress_setup(compress, &bad_compress, config, latency))
 		goto codec_fail;
-	}
-#endif
-
-	memcpy(compress->config, config, sizeof(*compress->config));
-	fill_compress_params(config, &params);
-
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_SET_PARAMS, &params)) {
-		oops(&bad_compress, errno, "cannot set device");
+	if (!(flags & COMPRESS_DEFER_PARAMS) &&
+	    compress_apply_params(compress, &bad_compress))
 		goto codec_fail;
-	}
 
 	return compress;
 
 codec_fail:
 	snd_utils_put_dev_node(compress->snd_node);
-	compress->ops->close(compress->data);
+	COMPRESS_OPS(compress)->close(compress->data);
 	compress->fd = -1;
 config_fail:
 	free(compress->config);
 input_fail:
+	pthread_mutex_destroy(&compress->marks_lock);
 	free(compress);
 	return &bad_compress;
 }
 
+struct compress *compress_open(unsigned int card, unsigned int device,
+		unsigned int flags, struct compr_config *config)
+{
+	return _compress_open(card, device, flags, config, NULL);
+}
+
+struct compress *compress_open_latency(unsigned int card,
+		unsigned int device, unsigned int flags,
+		struct compr_config *config, struct compr_latency *latency)
+{
+	if (!latency) {
+		oops(&bad_compress, EINVAL, "passed bad latency");
+		return &bad_compress;
+	}
+	return _compress_open(card, device, flags, config, latency);
+}
+
+struct compress_open_many {
+	struct compr_open_req *reqs;
+	unsigned int count;
+	atomic_uint next;
+};
+
+static void *compress_open_worker(void *arg)
+{
+	struct compress_open_many *batch = arg;
+	struct compr_open_req *req;
+	unsigned int i;
+
+	while ((i = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+		req = &batch->reqs[i];
+		req->compress = compress_open(req->card, req->device,
+				req->flags, req->config);
+		req->error = is_compress_ready(req->compress) ? 0 : errno;
+	}
+	return NULL;
+}
+
+int compress_open_many(struct compr_open_req *reqs, unsigned int count)
+{
+	struct compress_open_many batch = {
+		.reqs = reqs,
+		.count = count,
+	};
+	pthread_t tids[OPEN_MANY_MAX_THREADS - 1];
+	struct snd_node **nodes;
+	unsigned int i, threads, started = 0;
+	int opened = 0;
+
+	/*
+	 * Parse the card definitions up front and hold the nodes so the
+	 * parallel opens find them ready, plugin libraries are shared by
+	 * the library cache the same way.
+	 */
+	nodes = calloc(count, sizeof(*nodes));
+	for (i = 0; nodes && i < count; i++)
+		nodes[i] = snd_utils_get_dev_node(reqs[i].card,
+				reqs[i].device, NODE_COMPRESS);
+
+	threads = count < OPEN_MANY_MAX_THREADS ?
+		count : OPEN_MANY_MAX_THREADS;
+	/* the calling thread opens streams too */
+	for (i = 0; i + 1 < threads; i++) {
+		if (pthread_create(&tids[i], NULL, compress_open_worker, &batch))
+			break;
+		started++;
+	}
+	compress_open_worker(&batch);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	for (i = 0; nodes && i < count; i++)
+		snd_utils_put_dev_node(nodes[i]);
+	free(nodes);
+
+	for (i = 0; i < count; i++)
+		opened += !reqs[i].error;
+	return opened;
+}
+
+int compress_configure(struct compress *compress, struct compr_config *config)
+{
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+	if (!config)
+		return oops(compress, EINVAL, "passed bad config");
+	if (!compress->params_pending)
+		return oops(compress, EBUSY, "parameters already applied");
+
+	if (compress_setup(compress, compress, config, NULL))
+		return -1;
+	/* the stream no longer matches the config it was opened with */
+	compress->codec_changed = 1;
+	return 0;
+}
+
+int compress_pool_reset_stream(struct compress *compress)
+{
+	struct compr_feeder_stats feeder_stats;
+
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+	if (compress->codec_changed)
+		return oops(compress, EBUSY, "codec parameters changed");
+
+	if (compress->running) {
+		if (compress_stop(compress))
+			return -1;
+	} else {
+		/* data queued before start, only a reopen gets back to SETUP */
+		if (compress->feeder)
+			compress_feeder_get_stats(compress->feeder, &feeder_stats);
+		if (compress->setup_dirty || compress->staged ||
+		    compress->feeder_acquired ||
+		    (compress->feeder && (feeder_stats.occupancy ||
+					  compress_feeder_fed(compress->feeder))))
+			return oops(compress, EBUSY, "stream is not in setup state");
+	}
+
+	/* idle now, the next user may configure a new one */
+	compress_feeder_destroy(compress->feeder);
+	compress->feeder = NULL;
+	memset(&compress->feeder_config, 0, sizeof(compress->feeder_config));
+	compress->feeder_config.sched_policy = SCHED_OTHER;
+	compress->feeder_config.cpu = -1;
+	compress->ring_acquired = 0;
+
+	compress->running = 0;
+	compress->setup_dirty = 0;
+	compress->next_track = 0;
+	compress->gapless_metadata = 0;
+	compress->nonblocking = 0;
+	compress_set_max_poll_wait(compress, DEFAULT_MAX_POLL_WAIT_MS);
+	compress->low_mark = 0;
+	compress->high_mark = 0;
+	compress_set_bit_rate(compress, compress->codec.bit_rate);
+	compress_update_marks(compress);
+
+	compress->avail_accounting = compress_default_avail_accounting(compress);
+	atomic_store_explicit(&compress->avail_queried, 0, memory_order_relaxed);
+	atomic_store_explicit(&compress->avail_avoided, 0, memory_order_relaxed);
+	atomic_store_explicit(&compress->wakeups, 0, memory_order_relaxed);
+	atomic_store_explicit(&compress->wakeup_start_ns, 0,
+			memory_order_relaxed);
+	compress_reset_stats(compress);
+	compress_reset_histograms(compress);
+	return 0;
+}
+
 void compress_close(struct compress *compress)
 {
 	if (compress == &bad_compress)
 		return;
 
+	compress_feeder_destroy(compress->feeder);
 	snd_utils_put_dev_node(compress->snd_node);
-	compress->ops->close(compress->data);
+	COMPRESS_OPS(compress)->close(compress->data);
 	compress->running = 0;
 	compress->fd = -1;
+	free(compress->staging);
 	free(compress->config);
+	pthread_mutex_destroy(&compress->marks_lock);
 	free(compress);
 }
 
@@ -286,13 +1362,18 @@ int compress_get_hpointer(struct compress *compress,
 		unsigned int *avail, struct timespec *tstamp)
 {
 	struct snd_compr_avail kavail;
+	unsigned int gen;
 	__u64 time;
 
 	if (!is_compress_ready(compress))
 		return oops(compress, ENODEV, "device not ready");
 
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_AVAIL, &kavail))
+	gen = atomic_load_explicit(&compress->avail_gen, memory_order_acquire);
+	if (compress_ops_avail(compress, &kavail))
 		return oops(compress, errno, "cannot get avail");
+	/* with a feeder the estimate belongs to the feeder thread */
+	if (!compress->feeder)
+		compress_set_avail(compress, &compress->xfer, gen, kavail.avail);
 	if (0 == kavail.tstamp.sampling_rate)
 		return oops(compress, ENODATA, "sample rate unknown");
 	*avail = (unsigned int)kavail.avail;
@@ -311,7 +1392,7 @@ int compress_get_tstamp(struct compress *compress,
 	if (!is_compress_ready(compress))
 		return oops(compress, ENODEV, "device not ready");
 
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_TSTAMP, &ktstamp))
+	if (compress_ops_tstamp(compress, &ktstamp))
 		return oops(compress, errno, "cannot get tstamp");
 
 	*samples = ktstamp.pcm_io_frames;
@@ -319,102 +1400,357 @@ int compress_get_tstamp(struct compress *compress,
 	return 0;
 }
 
-int compress_write(struct compress *compress, const void *buf, unsigned int size)
+int compress_get_tstamp64(struct compress *compress,
+			unsigned long long *samples, unsigned int *sampling_rate)
+{
+	struct compress_plugin_tstamp64 ktstamp;
+
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+
+	if (compress_ops_tstamp64(compress, &ktstamp))
+		return oops(compress, errno, "cannot get tstamp");
+
+	*samples = ktstamp.pcm_io_frames;
+	*sampling_rate = ktstamp.sampling_rate;
+	return 0;
+}
+
+/*
+ * Fill vec with at most COMPR_IOV_MAX entries covering the next size bytes
+ * of iov, starting offset bytes into its first entry.
+ * Returns the number of entries used and the bytes they cover in len.
+ */
+static int compress_iov_window(const struct iovec *iov, int iovcnt,
+		size_t offset, size_t size, struct iovec *vec, size_t *len)
+{
+	size_t seg;
+	int n = 0;
+
+	*len = 0;
+	while (iovcnt && size && (n < COMPR_IOV_MAX)) {
+		seg = iov->iov_len - offset;
+		if (seg > size)
+			seg = size;
+		if (seg) {
+			vec[n].iov_base = (char *)iov->iov_base + offset;
+			vec[n].iov_len = seg;
+			*len += seg;
+			size -= seg;
+			n++;
+		}
+		offset = 0;
+		iov++;
+		iovcnt--;
+	}
+	return n;
+}
+
+static int compress_iov_size(const struct iovec *iov, int iovcnt,
+		size_t *size)
+{
+	int i;
+
+	*size = 0;
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > INT_MAX - *size)
+			return -EINVAL;
+		*size += iov[i].iov_len;
+	}
+	return 0;
+}
+
+/*
+ * Errors go to xfer->error; the feeder thread passes its own xfer so that
+ * it never writes the application's side of the stream.
+ */
+static int _compress_writev(struct compress *compress,
+		struct compress_xfer *xfer, const struct iovec *iov, int iovcnt,
+		int nonblocking, int poll_wait_ms)
 {
 	struct snd_compr_avail avail;
+	struct iovec vec[COMPR_IOV_MAX];
 	struct pollfd fds;
-	int to_write = 0;	/* zero indicates we haven't written yet */
-	int written, total = 0, ret;
-	const char* cbuf = buf;
+	size_t size, offset = 0, to_write;
+	int written, total = 0, ret, n, timeout;
+	int budget_ms = poll_wait_ms;
+	bool slept = false;
 	const unsigned int frag_size = compress->config->fragment_size;
 
 	if (!(compress->flags & COMPRESS_IN))
-		return oops(compress, EINVAL, "Invalid flag set");
+		return xfer_oops(xfer, EINVAL, "Invalid flag set");
 	if (!is_compress_ready(compress))
-		return oops(compress, ENODEV, "device not ready");
-	fds.events = POLLOUT;
+		return xfer_oops(xfer, ENODEV, "device not ready");
+	if ((iovcnt < 0) || compress_iov_size(iov, iovcnt, &size))
+		return xfer_oops(xfer, EINVAL, "invalid iovec");
 
 	/*TODO: treat auto start here first */
 	while (size) {
-		if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_AVAIL, &avail))
-			return oops(compress, errno, "cannot get avail");
+		/* stop in progress, drop the rest */
+		if (compress->feeder && compress_feeder_discarding(compress->feeder))
+			break;
+
+		if (compress_get_avail(compress, xfer, &avail, size))
+			return xfer_oops(xfer, errno, "cannot get avail");
+
+		/* We can write if the wakeup mark is reached, there is enough
+		 * space for all remaining data or a sleep to the mark fell
+		 * short, so that a paused stream fails the write
+		 */
+		if ((avail.avail < xfer->marks->avail_min) &&
+		    (compress_usable(xfer->marks, avail.avail) < size) &&
+		    !(slept && compress_usable(xfer->marks, avail.avail))) {
+
+			if (nonblocking)
+				return total;
+
+			fds.events = POLLOUT;
+			timeout = poll_wait_ms;
+			if (!slept && (xfer->marks->avail_min > frag_size) &&
+			    xfer->marks->bit_rate) {
+				fds.events = 0;
+				timeout = compress_mark_timeout(xfer->marks,
+						avail.avail, &budget_ms);
+				if (!timeout)
+					break;
+				slept = true;
+			}
+
+			ret = compress_poll(compress, &fds, timeout);
+			compress_count_wakeup(compress);
+			if (fds.revents & POLLERR) {
+				return xfer_oops(xfer, EIO, "poll returned error!");
+			}
+			/* A pause will cause -EBADFD or zero.
+			 * This is not an error, just stop writing */
+			if (ret < 0 && errno == EBADFD)
+				compress_stat_add(&compress->stats.pause_exits, 1);
+			/* the sleep to the mark is over, check again */
+			if ((ret >= 0) && !fds.events) {
+				xfer->avail_valid = 0;
+				continue;
+			}
+			if ((ret == 0) || (ret < 0 && errno == EBADFD))
+				break;
+			if (ret < 0)
+				return xfer_oops(xfer, errno, "poll error");
+			if (fds.revents & POLLOUT) {
+				continue;
+			}
+		}
+		/* write up to the high mark, across as many entries as needed */
+		n = compress_iov_window(iov, iovcnt, offset,
+				compress_usable(xfer->marks, avail.avail), vec, &to_write);
+		if (n == 1)
+			written = COMPRESS_OPS(compress)->write(compress->data,
+					vec[0].iov_base, vec[0].iov_len);
+		else
+			written = COMPRESS_OPS(compress)->writev(compress->data, vec, n);
+		compress_stat_add(&compress->stats.writes, 1);
+		if (written < 0) {
+			/* If play was paused the write returns -EBADFD */
+			if (errno == EBADFD) {
+				compress_stat_add(&compress->stats.pause_exits, 1);
+				break;
+			}
+			return xfer_oops(xfer, errno, "write failed!");
+		}
+		compress_stat_add(&compress->stats.bytes_written, written);
+		/* the feeder's writes are found through compress_feeder_fed() */
+		if (written && !compress->running && !compress->feeder)
+			compress->setup_dirty = 1;
+		if ((size_t)written < to_write)
+			compress_stat_add(&compress->stats.short_writes, 1);
+		compress_consume_avail(xfer, to_write, written);
+		budget_ms = poll_wait_ms;
+		slept = false;
+
+		size -= written;
+		total += written;
+		offset += written;
+		while (iovcnt && (offset >= iov->iov_len)) {
+			offset -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+	}
+	return total;
+}
+
+/* Runs in the feeder thread, always blocking but with a short poll() */
+static int compress_feed(void *ctx, const void *buf, size_t size)
+{
+	struct compress *compress = ctx;
+	struct iovec iov = {
+		.iov_base = (void *)buf,
+		.iov_len = size,
+	};
+	int poll_wait_ms;
+	int ret;
+
+	/* a consistent copy, the application may change them meanwhile */
+	pthread_mutex_lock(&compress->marks_lock);
+	compress->feeder_marks = compress->marks;
+	pthread_mutex_unlock(&compress->marks_lock);
+
+	poll_wait_ms = compress->feeder_marks.max_poll_wait_ms;
+	if ((poll_wait_ms < 0) || (poll_wait_ms > FEEDER_MAX_POLL_WAIT_MS))
+		poll_wait_ms = FEEDER_MAX_POLL_WAIT_MS;
+
+	ret = _compress_writev(compress, &compress->feeder_xfer, &iov, 1, 0,
+			poll_wait_ms);
+	return ret < 0 ? -errno : ret;
+}
+
+static int compress_create_feeder(struct compress *compress)
+{
+	struct compr_feeder_config *config = &compress->feeder_config;
+	size_t ring_size = config->ring_size;
+
+	if (compress->feeder)
+		return 0;
+
+	/* default to twice the device buffer */
+	if (!ring_size)
+		ring_size = 2 * (size_t)compress->config->fragment_size *
+			compress->config->fragments;
+
+	compress->feeder = compress_feeder_create(ring_size,
+			config->sched_policy, config->sched_priority, config->cpu,
+			compress_feed, compress);
+	if (!compress->feeder)
+		return oops(compress, errno, "cannot create feeder");
+	return 0;
+}
+
+/* Queue data for the feeder thread, never blocks */
+static int compress_queue_writev(struct compress *compress,
+		const struct iovec *iov, int iovcnt)
+{
+	size_t queued;
+	int total = 0, i, ret;
+
+	if (compress_create_feeder(compress))
+		return -1;
+
+	ret = compress_feeder_get_error(compress->feeder);
+	if (ret)
+		return oops(compress, -ret, "feeder write failed");
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > (size_t)(INT_MAX - total))
+			return oops(compress, EINVAL, "invalid iovec");
+		queued = compress_feeder_push(compress->feeder,
+				iov[i].iov_base, iov[i].iov_len);
+		total += queued;
+		if (queued < iov[i].iov_len)
+			break;
+	}
+	return total;
+}
+
+int compress_writev(struct compress *compress, const struct iovec *iov,
+		int iovcnt)
+{
+	struct timespec start;
+	int ret;
+
+	if (is_compress_ready(compress) &&
+	    compress_apply_params(compress, compress))
+		return -1;
 
-		/* We can write if we have at least one fragment available
-		 * or there is enough space for all remaining data
-		 */
-		if ((avail.avail < frag_size) && (avail.avail < size)) {
+	if (compress->flags & COMPRESS_FEEDER) {
+		if (!(compress->flags & COMPRESS_IN))
+			return oops(compress, EINVAL, "Invalid flag set");
+		if (!is_compress_ready(compress))
+			return oops(compress, ENODEV, "device not ready");
+		if (iovcnt < 0)
+			return oops(compress, EINVAL, "invalid iovec");
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ret = compress_queue_writev(compress, iov, iovcnt);
+		compress_hist_record(compress, COMPRESS_HIST_WRITE,
+				compress_elapsed_ns(&start));
+		return ret;
+	}
 
-			if (compress->nonblocking)
-				return total;
+	compress_trace_begin(compress->trace_id, "compress_write");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = _compress_writev(compress, &compress->xfer, iov, iovcnt,
+			compress->nonblocking, compress->marks.max_poll_wait_ms);
+	compress_hist_record(compress, COMPRESS_HIST_WRITE,
+			compress_elapsed_ns(&start));
+	compress_trace_end();
+	return ret;
+}
 
-			ret = compress->ops->poll(compress->data, &fds, 1,
-								compress->max_poll_wait_ms);
-			if (fds.revents & POLLERR) {
-				return oops(compress, EIO, "poll returned error!");
-			}
-			/* A pause will cause -EBADFD or zero.
-			 * This is not an error, just stop writing */
-			if ((ret == 0) || (ret < 0 && errno == EBADFD))
-				break;
-			if (ret < 0)
-				return oops(compress, errno, "poll error");
-			if (fds.revents & POLLOUT) {
-				continue;
-			}
-		}
-		/* write avail bytes */
-		if (size > avail.avail)
-			to_write =  avail.avail;
-		else
-			to_write = size;
-		written = compress->ops->write(compress->data, cbuf, to_write);
-		if (written < 0) {
-			/* If play was paused the write returns -EBADFD */
-			if (errno == EBADFD)
-				break;
-			return oops(compress, errno, "write failed!");
-		}
+int compress_write(struct compress *compress, const void *buf, unsigned int size)
+{
+	struct iovec iov = {
+		.iov_base = (void *)buf,
+		.iov_len = size,
+	};
 
-		size -= written;
-		cbuf += written;
-		total += written;
-	}
-	return total;
+	return compress_writev(compress, &iov, 1);
 }
 
-int compress_read(struct compress *compress, void *buf, unsigned int size)
+static int _compress_readv(struct compress *compress,
+		const struct iovec *iov, int iovcnt)
 {
 	struct snd_compr_avail avail;
+	struct iovec vec[COMPR_IOV_MAX];
 	struct pollfd fds;
-	int to_read = 0;
-	int num_read, total = 0, ret;
-	char* cbuf = buf;
+	size_t size, offset = 0, to_read;
+	int num_read, total = 0, ret, n, timeout;
+	int budget_ms = compress->marks.max_poll_wait_ms;
+	bool slept = false;
 	const unsigned int frag_size = compress->config->fragment_size;
 
 	if (!(compress->flags & COMPRESS_OUT))
 		return oops(compress, EINVAL, "Invalid flag set");
 	if (!is_compress_ready(compress))
 		return oops(compress, ENODEV, "device not ready");
-	fds.events = POLLIN;
+	if ((iovcnt < 0) || compress_iov_size(iov, iovcnt, &size))
+		return oops(compress, EINVAL, "invalid iovec");
 
 	while (size) {
-		if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_AVAIL, &avail))
+		if (compress_get_avail(compress, &compress->xfer, &avail, size))
 			return oops(compress, errno, "cannot get avail");
 
-		if ( (avail.avail < frag_size) && (avail.avail < size) ) {
-			/* Less than one fragment available and not at the
+		if ((avail.avail < compress->marks.avail_min) &&
+		    (compress_usable(&compress->marks, avail.avail) < size) &&
+		    !(slept && compress_usable(&compress->marks, avail.avail))) {
+			/* Wakeup mark not reached and not at the
 			 * end of the read, so poll
 			 */
 			if (compress->nonblocking)
 				return total;
 
-			ret = compress->ops->poll(compress->data, &fds, 1,
-							compress->max_poll_wait_ms);
+			fds.events = POLLIN;
+			timeout = compress->marks.max_poll_wait_ms;
+			if (!slept && (compress->marks.avail_min > frag_size) &&
+			    compress->marks.bit_rate) {
+				fds.events = 0;
+				timeout = compress_mark_timeout(&compress->marks,
+						avail.avail, &budget_ms);
+				if (!timeout)
+					break;
+				slept = true;
+			}
+
+			ret = compress_poll(compress, &fds, timeout);
+			compress_count_wakeup(compress);
 			if (fds.revents & POLLERR) {
 				return oops(compress, EIO, "poll returned error!");
 			}
 			/* A pause will cause -EBADFD or zero.
 			 * This is not an error, just stop reading */
+			if (ret < 0 && errno == EBADFD)
+				compress_stat_add(&compress->stats.pause_exits, 1);
+			/* the sleep to the mark is over, check again */
+			if ((ret >= 0) && !fds.events) {
+				compress->xfer.avail_valid = 0;
+				continue;
+			}
 			if ((ret == 0) || (ret < 0 && errno == EBADFD))
 				break;
 			if (ret < 0)
@@ -423,70 +1759,302 @@ int compress_read(struct compress *compress, void *buf, unsigned int size)
 				continue;
 			}
 		}
-		/* read avail bytes */
-		if (size > avail.avail)
-			to_read = avail.avail;
+		/* read down to the low mark, across as many entries as needed */
+		n = compress_iov_window(iov, iovcnt, offset,
+				compress_usable(&compress->marks, avail.avail), vec, &to_read);
+		if (n == 1)
+			num_read = COMPRESS_OPS(compress)->read(compress->data,
+					vec[0].iov_base, vec[0].iov_len);
 		else
-			to_read = size;
-		num_read = compress->ops->read(compress->data, cbuf, to_read);
+			num_read = COMPRESS_OPS(compress)->readv(compress->data, vec, n);
+		compress_stat_add(&compress->stats.reads, 1);
 		if (num_read < 0) {
 			/* If play was paused the read returns -EBADFD */
-			if (errno == EBADFD)
+			if (errno == EBADFD) {
+				compress_stat_add(&compress->stats.pause_exits, 1);
 				break;
+			}
 			return oops(compress, errno, "read failed!");
 		}
+		compress_stat_add(&compress->stats.bytes_read, num_read);
+		if ((size_t)num_read < to_read)
+			compress_stat_add(&compress->stats.short_reads, 1);
+		compress_consume_avail(&compress->xfer, to_read, num_read);
+		budget_ms = compress->marks.max_poll_wait_ms;
+		slept = false;
 
 		size -= num_read;
-		cbuf += num_read;
 		total += num_read;
+		offset += num_read;
+		while (iovcnt && (offset >= iov->iov_len)) {
+			offset -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
 	}
 
 	return total;
 }
 
-int compress_start(struct compress *compress)
+int compress_readv(struct compress *compress, const struct iovec *iov,
+		int iovcnt)
+{
+	int ret;
+
+	if (is_compress_ready(compress) &&
+	    compress_apply_params(compress, compress))
+		return -1;
+
+	compress_trace_begin(compress->trace_id, "compress_read");
+	ret = _compress_readv(compress, iov, iovcnt);
+	compress_trace_end();
+	return ret;
+}
+
+int compress_read(struct compress *compress, void *buf, unsigned int size)
 {
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = size,
+	};
+
+	return compress_readv(compress, &iov, 1);
+}
+
+static int compress_flush_staging(struct compress *compress)
+{
+	int written;
+
+	written = compress_write(compress, compress->staging, compress->staged);
+	if (written < 0)
+		return written;
+
+	/* keep what could not be written for the next commit */
+	compress->staged -= written;
+	memmove(compress->staging, compress->staging + written, compress->staged);
+	return 0;
+}
+
+int compress_get_buffer(struct compress *compress, void **buf,
+		unsigned int *size)
+{
+	struct pollfd fds;
+	size_t avail;
+	int ret;
+
+	if (!(compress->flags & COMPRESS_IN))
+		return oops(compress, EINVAL, "Invalid flag set");
 	if (!is_compress_ready(compress))
 		return oops(compress, ENODEV, "device not ready");
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_START))
-		return oops(compress, errno, "cannot start the stream");
-	compress->running = 1;
+	if (compress_apply_params(compress, compress))
+		return -1;
+
+	*size = 0;
+	fds.events = POLLOUT;
+
+	/* with a feeder its ring is the buffer, never blocks */
+	if (compress->flags & COMPRESS_FEEDER) {
+		if (compress_create_feeder(compress))
+			return -1;
+		ret = compress_feeder_get_error(compress->feeder);
+		if (ret)
+			return oops(compress, -ret, "feeder write failed");
+		compress_feeder_acquire(compress->feeder, buf, &avail);
+		compress->feeder_acquired = avail;
+		*size = avail > UINT_MAX ? UINT_MAX : avail;
+		return 0;
+	}
+
+	compress->ring_acquired = 0;
+	while (COMPRESS_OPS(compress)->get_buffer && !compress->staging) {
+		ret = COMPRESS_OPS(compress)->get_buffer(compress->data, buf, &avail);
+		if (ret == -ENOSYS)
+			break;
+		/* A pause will cause -EBADFD, just report no space */
+		if (ret == -EBADFD)
+			return 0;
+		if (ret < 0)
+			return oops(compress, -ret, "cannot get buffer");
+
+		if (avail || compress->nonblocking) {
+			*size = avail > UINT_MAX ? UINT_MAX : avail;
+			compress->ring_acquired = *size;
+			return 0;
+		}
+
+		ret = compress_poll(compress, &fds, compress->marks.max_poll_wait_ms);
+		if (fds.revents & POLLERR)
+			return oops(compress, EIO, "poll returned error!");
+		if ((ret == 0) || (ret == -EBADFD) || (ret < 0 && errno == EBADFD))
+			return 0;
+		if (ret < 0)
+			return oops(compress, errno, "poll error");
+	}
+
+	/* No direct ring access, hand out the library owned staging area */
+	if (!compress->staging) {
+		compress->staging_size = compress->config->fragment_size;
+		compress->staging = malloc(compress->staging_size);
+		if (!compress->staging)
+			return oops(compress, ENOMEM, "cannot allocate staging buffer");
+	}
+
+	if ((compress->staged == compress->staging_size) &&
+	    compress_flush_staging(compress))
+		return -1;
+
+	*buf = compress->staging + compress->staged;
+	*size = compress->staging_size - compress->staged;
+	return 0;
+}
+
+int compress_commit(struct compress *compress, unsigned int size)
+{
+	int ret;
+
+	if (!(compress->flags & COMPRESS_IN))
+		return oops(compress, EINVAL, "Invalid flag set");
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+
+	if (compress->feeder) {
+		if (size > compress->feeder_acquired)
+			return oops(compress, EINVAL, "commit exceeds acquired buffer");
+		compress_feeder_publish(compress->feeder, size);
+		compress->feeder_acquired = 0;
+		return 0;
+	}
+
+	if (!compress->staging) {
+		if (!COMPRESS_OPS(compress)->commit)
+			return oops(compress, EINVAL, "no buffer acquired");
+		if (size > compress->ring_acquired)
+			return oops(compress, EINVAL, "commit exceeds acquired buffer");
+
+		ret = COMPRESS_OPS(compress)->commit(compress->data, size);
+		compress->ring_acquired = 0;
+		compress_stat_add(&compress->stats.writes, 1);
+		if (ret < 0)
+			return oops(compress, -ret, "cannot commit buffer");
+		compress_stat_add(&compress->stats.bytes_written, size);
+		if (size && !compress->running)
+			compress->setup_dirty = 1;
+		compress_consume_avail(&compress->xfer, size, size);
+		return 0;
+	}
+
+	if (size > compress->staging_size - compress->staged)
+		return oops(compress, EINVAL, "commit exceeds acquired buffer");
+
+	compress->staged += size;
+	if (compress_flush_staging(compress))
+		return -1;
+	return 0;
+}
+
+/*
+ * Wait for the feeder to hand queued data to the device, the control
+ * operations act on what the device has, not on what the app wrote.
+ */
+static int compress_sync_feeder(struct compress *compress, int until_fed)
+{
+	int ret;
+
+	if (!compress->feeder)
+		return 0;
+
+	ret = compress_feeder_sync(compress->feeder, until_fed,
+			compress->marks.max_poll_wait_ms);
+	if (ret)
+		return oops(compress, -ret, "cannot flush feeder");
 	return 0;
+}
 
+int compress_start(struct compress *compress)
+{
+	int ret = -1;
+
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+	if (compress_apply_params(compress, compress))
+		return -1;
+	compress_trace_begin(compress->trace_id, "compress_start");
+	if (compress_sync_feeder(compress, 1))
+		goto out;
+	compress_invalidate_avail(compress);
+	if (compress_ops_start(compress)) {
+		oops(compress, errno, "cannot start the stream");
+		goto out;
+	}
+	compress->running = 1;
+	ret = 0;
+out:
+	compress_trace_end();
+	return ret;
 }
 
 int compress_stop(struct compress *compress)
 {
+	int ret;
+
 	if (!is_compress_running(compress))
 		return oops(compress, ENODEV, "device not ready");
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_STOP))
-		return oops(compress, errno, "cannot stop the stream");
-	return 0;
+	compress_trace_begin(compress->trace_id, "compress_stop");
+	if (compress->feeder) {
+		ret = compress_feeder_discard(compress->feeder,
+				compress->marks.max_poll_wait_ms);
+		if (ret) {
+			ret = oops(compress, -ret, "cannot discard feeder data");
+			goto out;
+		}
+	}
+	compress_invalidate_avail(compress);
+	ret = compress_ops_stop(compress);
+	if (ret)
+		ret = oops(compress, errno, "cannot stop the stream");
+out:
+	compress_trace_end();
+	return ret;
 }
 
 int compress_pause(struct compress *compress)
 {
 	if (!is_compress_running(compress))
 		return oops(compress, ENODEV, "device not ready");
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_PAUSE))
+	compress_invalidate_avail(compress);
+	if (compress_ioctl(compress, SNDRV_COMPRESS_PAUSE, NULL))
 		return oops(compress, errno, "cannot pause the stream");
 	return 0;
 }
 
 int compress_resume(struct compress *compress)
 {
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_RESUME))
+	compress_invalidate_avail(compress);
+	if (compress_ioctl(compress, SNDRV_COMPRESS_RESUME, NULL))
 		return oops(compress, errno, "cannot resume the stream");
+	if (compress->feeder)
+		compress_feeder_kick(compress->feeder);
 	return 0;
 }
 
 int compress_drain(struct compress *compress)
 {
+	int ret = -1;
+
 	if (!is_compress_running(compress))
 		return oops(compress, ENODEV, "device not ready");
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_DRAIN))
-		return oops(compress, errno, "cannot drain the stream");
-	return 0;
+	compress_trace_begin(compress->trace_id, "compress_drain");
+	if (compress_sync_feeder(compress, 0))
+		goto out;
+	compress_invalidate_avail(compress);
+	if (compress_ioctl(compress, SNDRV_COMPRESS_DRAIN, NULL)) {
+		oops(compress, errno, "cannot drain the stream");
+		goto out;
+	}
+	ret = 0;
+out:
+	compress_trace_end();
+	return ret;
 }
 
 int compress_partial_drain(struct compress *compress)
@@ -496,7 +2064,10 @@ int compress_partial_drain(struct compress *compress)
 
 	if (!compress->next_track)
 		return oops(compress, EPERM, "next track not signalled");
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_PARTIAL_DRAIN))
+	if (compress_sync_feeder(compress, 0))
+		return -1;
+	compress_invalidate_avail(compress);
+	if (compress_ioctl(compress, SNDRV_COMPRESS_PARTIAL_DRAIN, NULL))
 		return oops(compress, errno, "cannot drain the stream\n");
 	compress->next_track = 0;
 	return 0;
@@ -509,7 +2080,9 @@ int compress_next_track(struct compress *compress)
 
 	if (!compress->gapless_metadata)
 		return oops(compress, EPERM, "metadata not set");
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_NEXT_TRACK))
+	if (compress_sync_feeder(compress, 0))
+		return -1;
+	if (compress_ioctl(compress, SNDRV_COMPRESS_NEXT_TRACK, NULL))
 		return oops(compress, errno, "cannot set next track\n");
 	compress->next_track = 1;
 	compress->gapless_metadata = 0;
@@ -519,7 +2092,7 @@ int compress_next_track(struct compress *compress)
 int compress_set_gapless_metadata(struct compress *compress,
 	struct compr_gapless_mdata *mdata)
 {
-	struct snd_compr_metadata metadata;
+	struct snd_compr_metadata metadata[2];
 	int version;
 
 	if (!is_compress_ready(compress))
@@ -532,14 +2105,12 @@ int compress_set_gapless_metadata(struct compress *compress,
 	if (version < SNDRV_PROTOCOL_VERSION(0, 1, 1))
 		return oops(compress, ENXIO, "gapless apis not supported in kernel");
 
-	metadata.key = SNDRV_COMPRESS_ENCODER_PADDING;
-	metadata.value[0] = mdata->encoder_padding;
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_SET_METADATA, &metadata))
-		return oops(compress, errno, "can't set metadata for stream\n");
-
-	metadata.key = SNDRV_COMPRESS_ENCODER_DELAY;
-	metadata.value[0] = mdata->encoder_delay;
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_SET_METADATA, &metadata))
+	memset(metadata, 0, sizeof(metadata));
+	metadata[0].key = SNDRV_COMPRESS_ENCODER_PADDING;
+	metadata[0].value[0] = mdata->encoder_padding;
+	metadata[1].key = SNDRV_COMPRESS_ENCODER_DELAY;
+	metadata[1].value[0] = mdata->encoder_delay;
+	if (compress_ops_set_metadata(compress, metadata, 2))
 		return oops(compress, errno, "can't set metadata for stream\n");
 	compress->gapless_metadata = 1;
 	return 0;
@@ -566,35 +2137,63 @@ int compress_set_next_track_param(struct compress *compress,
 bool is_codec_supported(unsigned int card, unsigned int device,
 		unsigned int flags, struct snd_codec *codec)
 {
-	struct compress_ops *ops;
-	void *snd_node, *data;
-	bool ret;
-	int compress_type, fd;
-
-	snd_node = snd_utils_get_dev_node(card, device, NODE_COMPRESS);
-	compress_type = snd_utils_get_node_type(snd_node);
-	if (compress_type == SND_NODE_TYPE_PLUGIN)
-		ops = &compr_plug_ops;
-	else
-		ops = &compr_hw_ops;
+	struct snd_compr_caps caps;
+	struct snd_compr_codec_caps codec_caps;
+	bool reported;
 
-	fd = ops->open(card, device, flags, &data, NULL);
-	if (fd < 0) {
-		oops(&bad_compress, errno, "cannot open card %u, device %u",
-					card, device);
+	if (compress_get_device_caps(card, device, flags, codec->id, &caps,
+				&codec_caps, &reported))
 		return false;
+
+	return _is_codec_supported(&caps, reported ? &codec_caps : NULL, codec);
+}
+
+int compress_get_best_codec_config(unsigned int card, unsigned int device,
+		unsigned int flags, struct snd_codec *codec)
+{
+	struct snd_compr_caps caps;
+	struct snd_compr_codec_caps codec_caps;
+	struct snd_codec fit, best;
+	unsigned int i, cost, lowest = UINT_MAX;
+	bool reported;
+
+	if (compress_get_device_caps(card, device, flags, codec->id, &caps,
+				&codec_caps, &reported))
+		return -1;
+
+	if (!_is_codec_type_supported(&caps, codec))
+		return oops(&bad_compress, EINVAL, "codec %u not supported",
+				codec->id);
+	if (!reported || !codec_caps.num_descriptors)
+		return 0;
+
+	/* the descriptor needing the smallest changes wins */
+	for (i = 0; i < codec_caps.num_descriptors && lowest; i++) {
+		fit = *codec;
+		cost = compress_desc_fit(&codec_caps.descriptor[i], &fit);
+		if (cost < lowest) {
+			lowest = cost;
+			best = fit;
+		}
 	}
 
-	ret = _is_codec_type_supported(ops, data, codec);
+	*codec = best;
+	return 0;
+}
 
-	snd_utils_put_dev_node(snd_node);
-	ops->close(data);
-	return ret;
+#ifdef COMPRESS_HW_ONLY
+/* nothing to unload without plugins, kept for callers of both builds */
+void compress_set_plugin_policy(
+		enum compress_plugin_policy policy __attribute__((unused)))
+{
 }
+#endif
 
 void compress_set_max_poll_wait(struct compress *compress, int milliseconds)
 {
-	compress->max_poll_wait_ms = milliseconds;
+	pthread_mutex_lock(&compress->marks_lock);
+	compress->marks.max_poll_wait_ms = milliseconds;
+	pthread_mutex_unlock(&compress->marks_lock);
 }
 
 void compress_nonblock(struct compress *compress, int nonblock)
@@ -602,6 +2201,221 @@ void compress_nonblock(struct compress *compress, int nonblock)
 	compress->nonblocking = !!nonblock;
 }
 
+void compress_set_avail_accounting(struct compress *compress, int enable)
+{
+	compress->avail_accounting = !!enable;
+	compress_invalidate_avail(compress);
+}
+
+int compress_set_feeder_config(struct compress *compress,
+		const struct compr_feeder_config *config)
+{
+	if (!(compress->flags & COMPRESS_FEEDER))
+		return oops(compress, EINVAL, "stream not opened with a feeder");
+	if (compress->feeder)
+		return oops(compress, EBUSY, "feeder already running");
+
+	memcpy(&compress->feeder_config, config, sizeof(*config));
+	return 0;
+}
+
+int compress_get_feeder_stats(struct compress *compress,
+		struct compr_feeder_stats *stats)
+{
+	if (!(compress->flags & COMPRESS_FEEDER))
+		return oops(compress, EINVAL, "stream not opened with a feeder");
+
+	memset(stats, 0, sizeof(*stats));
+	if (compress->feeder)
+		compress_feeder_get_stats(compress->feeder, stats);
+	return 0;
+}
+
+int compress_set_watermarks(struct compress *compress, unsigned int low,
+		unsigned int high)
+{
+	const unsigned int frag_size = compress->config->fragment_size;
+	const unsigned int buffer_size = frag_size * compress->config->fragments;
+	unsigned int avail_min;
+
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+
+	if (low || high) {
+		if ((low >= high) || (high > buffer_size))
+			return oops(compress, EINVAL, "invalid watermarks");
+
+		/* beyond one fragment we wake up on time, not on poll() */
+		avail_min = (compress->flags & COMPRESS_IN) ?
+			buffer_size - low : high;
+		if ((avail_min > frag_size) && !compress->marks.bit_rate)
+			return oops(compress, EINVAL, "bit rate unknown");
+	}
+
+	compress->low_mark = low;
+	compress->high_mark = high;
+	compress_update_marks(compress);
+	return 0;
+}
+
+int compress_set_watermarks_ms(struct compress *compress,
+		unsigned int low_ms, unsigned int high_ms)
+{
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+	if (!compress->marks.bit_rate)
+		return oops(compress, EINVAL, "bit rate unknown");
+
+	return compress_set_watermarks(compress,
+			(__u64)low_ms * compress->marks.bit_rate / 8000,
+			(__u64)high_ms * compress->marks.bit_rate / 8000);
+}
+
+int compress_get_wakeups(struct compress *compress, unsigned long *wakeups,
+		unsigned int *per_sec)
+{
+	struct timespec now;
+	unsigned long long start_ns;
+	__u64 elapsed_ms;
+
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+
+	/* the feeder thread may be counting concurrently */
+	*wakeups = atomic_load_explicit(&compress->wakeups, memory_order_relaxed);
+	start_ns = atomic_load_explicit(&compress->wakeup_start_ns,
+			memory_order_relaxed);
+	*per_sec = 0;
+	if (*wakeups && start_ns) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ms = (now.tv_sec * 1000000000ULL + now.tv_nsec -
+				start_ns) / 1000000;
+		if (elapsed_ms)
+			*per_sec = *wakeups * 1000ULL / elapsed_ms;
+	}
+	return 0;
+}
+
+int compress_get_avail_accounting(struct compress *compress,
+		unsigned long *queried, unsigned long *avoided)
+{
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+
+	*queried = atomic_load_explicit(&compress->avail_queried,
+			memory_order_relaxed);
+	*avoided = atomic_load_explicit(&compress->avail_avoided,
+			memory_order_relaxed);
+	return 0;
+}
+
+int compress_get_stats(struct compress *compress,
+		struct compress_stats *stats)
+{
+	struct compress_counters *c = &compress->stats;
+
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+
+	stats->bytes_written = atomic_load_explicit(&c->bytes_written,
+			memory_order_relaxed);
+	stats->bytes_read = atomic_load_explicit(&c->bytes_read,
+			memory_order_relaxed);
+	stats->ioctls = atomic_load_explicit(&c->ioctls, memory_order_relaxed);
+	stats->writes = atomic_load_explicit(&c->writes, memory_order_relaxed);
+	stats->reads = atomic_load_explicit(&c->reads, memory_order_relaxed);
+	stats->polls = atomic_load_explicit(&c->polls, memory_order_relaxed);
+	stats->short_writes = atomic_load_explicit(&c->short_writes,
+			memory_order_relaxed);
+	stats->short_reads = atomic_load_explicit(&c->short_reads,
+			memory_order_relaxed);
+	stats->pause_exits = atomic_load_explicit(&c->pause_exits,
+			memory_order_relaxed);
+	stats->poll_timeouts = atomic_load_explicit(&c->poll_timeouts,
+			memory_order_relaxed);
+	stats->blocked_ns = atomic_load_explicit(&c->blocked_ns,
+			memory_order_relaxed);
+	stats->max_stall_ns = atomic_load_explicit(&c->max_stall_ns,
+			memory_order_relaxed);
+	return 0;
+}
+
+void compress_reset_stats(struct compress *compress)
+{
+	struct compress_counters *c = &compress->stats;
+
+	atomic_store_explicit(&c->bytes_written, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->bytes_read, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->ioctls, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->writes, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->reads, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->polls, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->short_writes, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->short_reads, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->pause_exits, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->poll_timeouts, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->blocked_ns, 0, memory_order_relaxed);
+	atomic_store_explicit(&c->max_stall_ns, 0, memory_order_relaxed);
+}
+
+int compress_get_histogram(struct compress *compress,
+		enum compress_hist_type type, struct compress_hist *hist)
+{
+	unsigned int i;
+
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+	if ((unsigned int)type >= COMPRESS_HIST_MAX)
+		return oops(compress, EINVAL, "invalid histogram %d", type);
+
+	for (i = 0; i < COMPRESS_HIST_BUCKETS; i++)
+		hist->count[i] = atomic_load_explicit(&compress->hist.count[type][i],
+				memory_order_relaxed);
+	return 0;
+}
+
+void compress_reset_histograms(struct compress *compress)
+{
+	unsigned int type, i;
+
+	for (type = 0; type < COMPRESS_HIST_MAX; type++)
+		for (i = 0; i < COMPRESS_HIST_BUCKETS; i++)
+			atomic_store_explicit(&compress->hist.count[type][i], 0,
+					memory_order_relaxed);
+}
+
+int compress_dump_histograms(struct compress *compress, int fd)
+{
+	static const char * const names[COMPRESS_HIST_MAX] = {
+		[COMPRESS_HIST_POLL_WAIT] = "poll wait",
+		[COMPRESS_HIST_WRITE] = "write latency",
+		[COMPRESS_HIST_AVAIL] = "avail latency",
+	};
+	struct compress_hist hist;
+	unsigned long long lo, hi;
+	unsigned int type, i;
+
+	for (type = 0; type < COMPRESS_HIST_MAX; type++) {
+		if (compress_get_histogram(compress, type, &hist))
+			return -1;
+
+		dprintf(fd, "%s (us):\n", names[type]);
+		for (i = 0; i < COMPRESS_HIST_BUCKETS; i++) {
+			if (!hist.count[i])
+				continue;
+			lo = i ? 1ULL << (i - 1) : 0;
+			hi = 1ULL << i;
+			if (i == COMPRESS_HIST_BUCKETS - 1)
+				dprintf(fd, "  %10llu+          %llu\n", lo,
+						hist.count[i]);
+			else
+				dprintf(fd, "  %10llu-%-10llu %llu\n", lo, hi,
+						hist.count[i]);
+		}
+	}
+	return 0;
+}
+
 int compress_wait(struct compress *compress, int timeout_ms)
 {
 	struct pollfd fds;
@@ -609,7 +2423,7 @@ int compress_wait(struct compress *compress, int timeout_ms)
 
 	fds.events = POLLOUT | POLLIN;
 
-	ret = compress->ops->poll(compress->data, &fds, 1, timeout_ms);
+	ret = compress_poll(compress, &fds, timeout_ms);
 	if (ret > 0) {
 		if (fds.revents & POLLERR)
 			return oops(compress, EIO, "poll returned error!");
@@ -624,6 +2438,51 @@ int compress_wait(struct compress *compress, int timeout_ms)
 	return oops(compress, EIO, "poll signalled unhandled event");
 }
 
+int compress_get_poll_descriptors(struct compress *compress,
+		struct pollfd *pfds, unsigned int space)
+{
+	short events;
+	int fd;
+
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+	if (compress->flags & COMPRESS_FEEDER)
+		return oops(compress, EINVAL, "device is polled by the feeder");
+	if (!space)
+		return oops(compress, EINVAL, "no space for descriptors");
+	if (!COMPRESS_OPS(compress)->get_poll_fd)
+		return oops(compress, ENOSYS, "no pollable descriptor");
+
+	fd = COMPRESS_OPS(compress)->get_poll_fd(compress->data, &events);
+	if (fd < 0)
+		return oops(compress, -fd, "no pollable descriptor");
+
+	pfds[0].fd = fd;
+	pfds[0].events = events;
+	pfds[0].revents = 0;
+	return 1;
+}
+
+int compress_handle_revents(struct compress *compress, struct pollfd *pfds,
+		unsigned int nfds, unsigned short *revents)
+{
+	short events;
+	int ret;
+
+	if (!is_compress_ready(compress))
+		return oops(compress, ENODEV, "device not ready");
+	if ((nfds != 1) || !COMPRESS_OPS(compress)->handle_revents)
+		return oops(compress, EINVAL, "invalid descriptors");
+
+	ret = COMPRESS_OPS(compress)->handle_revents(compress->data, pfds[0].revents,
+			&events);
+	if (ret < 0)
+		return oops(compress, -ret, "cannot handle revents");
+
+	*revents = events;
+	return 0;
+}
+
 int compress_set_codec_params(struct compress *compress,
 	struct snd_codec *codec) {
 	struct snd_compr_params params;
@@ -634,12 +2493,15 @@ int compress_set_codec_params(struct compress *compress,
 	params.buffer.fragment_size = compress->config->fragment_size;
 	params.buffer.fragments = compress->config->fragments;
 	memcpy(&params.codec, codec, sizeof(params.codec));
-	memcpy(&compress->config->codec, codec, sizeof(struct snd_codec));
 
-	if (compress->ops->ioctl(compress->data, SNDRV_COMPRESS_SET_PARAMS, &params))
+	if (compress_ops_set_params(compress, &params))
 		return oops(compress, errno, "cannot set device");
 
+	compress->codec = *codec;
+	if (codec->bit_rate)
+		compress_set_bit_rate(compress, codec->bit_rate);
 	compress->next_track = 0;
+	compress->codec_changed = 1;
 	return 0;
 }
 
@@ -0,0 +1,263 @@
+/* compress_caps.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <linux/types.h>
+#define __force
+#define __bitwise
+#define __user
+#include "sound/compress_params.h"
+#include "sound/compress_offload.h"
+#include "tinycompress/tinycompress.h"
+#include "compress_caps.h"
+
+#define COMPRESS_CAPS_DIR(flags)	((flags) & (COMPRESS_IN | COMPRESS_OUT))
+
+/*
+ * SNDRV_COMPRESS_GET_CODEC_CAPS result of one codec, only the reported
+ * descriptors are kept. Drivers which don't implement the ioctl are
+ * remembered with reported = false.
+ */
+struct compress_codec_caps_entry {
+	struct compress_codec_caps_entry *next;
+	unsigned int codec;
+	bool reported;
+	unsigned int num_descriptors;
+	struct snd_codec_desc descriptor[];
+};
+
+struct compress_caps_entry {
+	struct compress_caps_entry *next;
+	unsigned int card;
+	unsigned int device;
+	unsigned int dir;
+	struct timespec stamp;
+	struct snd_compr_caps caps;
+	struct compress_codec_caps_entry *codecs;
+};
+
+static pthread_mutex_t caps_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct compress_caps_entry *caps_cache;
+/* 0 keeps entries until they are invalidated */
+static unsigned int caps_ttl_ms;
+
+static bool compress_caps_expired(const struct compress_caps_entry *entry)
+{
+	struct timespec now;
+	unsigned long long age_ms;
+
+	if (!caps_ttl_ms)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	age_ms = (now.tv_sec - entry->stamp.tv_sec) * 1000ULL +
+		(now.tv_nsec - entry->stamp.tv_nsec) / 1000000;
+	return age_ms >= caps_ttl_ms;
+}
+
+static void compress_caps_free(struct compress_caps_entry *entry)
+{
+	struct compress_codec_caps_entry *codec;
+
+	while ((codec = entry->codecs)) {
+		entry->codecs = codec->next;
+		free(codec);
+	}
+	free(entry);
+}
+
+/* Called with caps_lock held, returns the link pointing at the entry */
+static struct compress_caps_entry **compress_caps_find(unsigned int card,
+		unsigned int device, unsigned int dir)
+{
+	struct compress_caps_entry **link;
+
+	for (link = &caps_cache; *link; link = &(*link)->next) {
+		if (((*link)->card == card) && ((*link)->device == device) &&
+		    ((*link)->dir == dir))
+			break;
+	}
+	return link;
+}
+
+int compress_caps_lookup(unsigned int card, unsigned int device,
+		unsigned int flags, struct snd_compr_caps *caps)
+{
+	struct compress_caps_entry **link, *entry;
+	int ret = -ENOENT;
+
+	pthread_mutex_lock(&caps_lock);
+	link = compress_caps_find(card, device, COMPRESS_CAPS_DIR(flags));
+	entry = *link;
+	if (entry && compress_caps_expired(entry)) {
+		*link = entry->next;
+		compress_caps_free(entry);
+	} else if (entry) {
+		memcpy(caps, &entry->caps, sizeof(*caps));
+		ret = 0;
+	}
+	pthread_mutex_unlock(&caps_lock);
+
+	return ret;
+}
+
+void compress_caps_store(unsigned int card, unsigned int device,
+		unsigned int flags, const struct snd_compr_caps *caps)
+{
+	struct compress_caps_entry **link, *entry;
+
+	pthread_mutex_lock(&caps_lock);
+	link = compress_caps_find(card, device, COMPRESS_CAPS_DIR(flags));
+	entry = *link;
+	if (!entry) {
+		/* the cache is only an optimisation, skip it without memory */
+		entry = calloc(1, sizeof(*entry));
+		if (!entry)
+			goto out;
+		entry->card = card;
+		entry->device = device;
+		entry->dir = COMPRESS_CAPS_DIR(flags);
+		*link = entry;
+	}
+	memcpy(&entry->caps, caps, sizeof(entry->caps));
+	clock_gettime(CLOCK_MONOTONIC, &entry->stamp);
+out:
+	pthread_mutex_unlock(&caps_lock);
+}
+
+int compress_codec_caps_lookup(unsigned int card, unsigned int device,
+		unsigned int flags, unsigned int codec_id,
+		struct snd_compr_codec_caps *codec_caps)
+{
+	struct compress_caps_entry **link, *entry;
+	struct compress_codec_caps_entry *codec = NULL;
+	int ret = -ENOENT;
+
+	pthread_mutex_lock(&caps_lock);
+	link = compress_caps_find(card, device, COMPRESS_CAPS_DIR(flags));
+	entry = *link;
+	if (entry && compress_caps_expired(entry)) {
+		*link = entry->next;
+		compress_caps_free(entry);
+		entry = NULL;
+	}
+	if (entry) {
+		for (codec = entry->codecs; codec; codec = codec->next) {
+			if (codec->codec == codec_id)
+				break;
+		}
+	}
+	if (codec && !codec->reported) {
+		ret = -ENOTSUP;
+	} else if (codec) {
+		codec_caps->codec = codec_id;
+		codec_caps->num_descriptors = codec->num_descriptors;
+		memcpy(codec_caps->descriptor, codec->descriptor,
+				codec->num_descriptors * sizeof(codec->descriptor[0]));
+		ret = 0;
+	}
+	pthread_mutex_unlock(&caps_lock);
+
+	return ret;
+}
+
+void compress_codec_caps_store(unsigned int card, unsigned int device,
+		unsigned int flags, unsigned int codec_id,
+		const struct snd_compr_codec_caps *codec_caps)
+{
+	struct compress_caps_entry *entry;
+	struct compress_codec_caps_entry *codec, **link;
+	unsigned int num = 0;
+
+	if (codec_caps) {
+		num = codec_caps->num_descriptors;
+		if (num > MAX_NUM_CODEC_DESCRIPTORS)
+			num = MAX_NUM_CODEC_DESCRIPTORS;
+	}
+
+	codec = calloc(1, sizeof(*codec) + num * sizeof(codec->descriptor[0]));
+	if (!codec)
+		return;
+	codec->codec = codec_id;
+	codec->reported = codec_caps != NULL;
+	codec->num_descriptors = num;
+	if (num)
+		memcpy(codec->descriptor, codec_caps->descriptor,
+				num * sizeof(codec->descriptor[0]));
+
+	pthread_mutex_lock(&caps_lock);
+	/* codec caps live and expire with the caps of their device */
+	entry = *compress_caps_find(card, device, COMPRESS_CAPS_DIR(flags));
+	if (!entry) {
+		free(codec);
+		goto out;
+	}
+	for (link = &entry->codecs; *link; link = &(*link)->next) {
+		if ((*link)->codec == codec_id) {
+			codec->next = (*link)->next;
+			free(*link);
+			break;
+		}
+	}
+	*link = codec;
+out:
+	pthread_mutex_unlock(&caps_lock);
+}
+
+void compress_invalidate_caps(int card, int device)
+{
+	struct compress_caps_entry **link, *entry;
+
+	pthread_mutex_lock(&caps_lock);
+	link = &caps_cache;
+	while ((entry = *link)) {
+		if (((card < 0) || (entry->card == (unsigned int)card)) &&
+		    ((device < 0) || (entry->device == (unsigned int)device))) {
+			*link = entry->next;
+			compress_caps_free(entry);
+		} else {
+			link = &entry->next;
+		}
+	}
+	pthread_mutex_unlock(&caps_lock);
+}
+
+void compress_set_caps_ttl(unsigned int ttl_ms)
+{
+	pthread_mutex_lock(&caps_lock);
+	caps_ttl_ms = ttl_ms;
+	pthread_mutex_unlock(&caps_lock);
+}
@@ -0,0 +1,67 @@
+/* compress_caps.h
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#ifndef __COMPRESS_CAPS_H__
+#define __COMPRESS_CAPS_H__
+
+struct snd_compr_caps;
+struct snd_compr_codec_caps;
+
+/*
+ * Process wide cache of SNDRV_COMPRESS_GET_CAPS results, keyed by card,
+ * device and stream direction (COMPRESS_IN or COMPRESS_OUT in flags).
+ */
+
+/* Copy the cached caps, returns 0 or -ENOENT when missing or expired */
+int compress_caps_lookup(unsigned int card, unsigned int device,
+		unsigned int flags, struct snd_compr_caps *caps);
+
+/* Add or refresh the caps of a device */
+void compress_caps_store(unsigned int card, unsigned int device,
+		unsigned int flags, const struct snd_compr_caps *caps);
+
+/*
+ * Copy the cached SNDRV_COMPRESS_GET_CODEC_CAPS descriptors of a codec,
+ * returns 0, -ENOTSUP when the driver doesn't report them or -ENOENT when
+ * missing or expired
+ */
+int compress_codec_caps_lookup(unsigned int card, unsigned int device,
+		unsigned int flags, unsigned int codec_id,
+		struct snd_compr_codec_caps *codec_caps);
+
+/*
+ * Add or refresh the descriptors of a codec, NULL codec_caps records that
+ * the driver doesn't report them. The caps of the device must be cached.
+ */
+void compress_codec_caps_store(unsigned int card, unsigned int device,
+		unsigned int flags, unsigned int codec_id,
+		const struct snd_compr_codec_caps *codec_caps);
+
+#endif /* __COMPRESS_CAPS_H__ */
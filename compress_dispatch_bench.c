@@ -0,0 +1,148 @@
+/* compress_dispatch_bench.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+/*
+ * Measures the per-call cost of the queries made on every transfer,
+ * compress_get_hpointer() (AVAIL) and compress_get_tstamp() (TSTAMP), on
+ * an opened but idle stream. The device is never started, so the time is
+ * the library dispatch plus the backend, which for a plugin is a function
+ * call. Run it on builds before and after a change to the dispatch path
+ * to compare.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/time.h>
+#include <linux/types.h>
+#define __force
+#define __bitwise
+#define __user
+#include "sound/compress_params.h"
+#include "tinycompress/tinycompress.h"
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: compress_dispatch_bench [OPTIONS]\n"
+		"-c\tcard number\n"
+		"-d\tdevice node\n"
+		"-n\tcalls per query (default 1000000)\n"
+		"-I\tcodec id (default MP3)\n"
+		"-h\tPrints this help list\n\n"
+		"Example:\n"
+		"\tcompress_dispatch_bench -c 0 -d 1 -n 100000\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static double elapsed_ns(const struct timespec *start,
+		const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000.0 +
+		(end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char **argv)
+{
+	struct compr_config config;
+	struct snd_codec codec;
+	struct compress *compress;
+	struct timespec start, end, tstamp;
+	unsigned int card = 0, device = 0, iterations = 1000000;
+	unsigned int i, avail, rate;
+	unsigned long samples;
+	double avail_ns, tstamp_ns;
+	int c;
+
+	memset(&codec, 0, sizeof(codec));
+	codec.id = SND_AUDIOCODEC_MP3;
+	codec.sample_rate = 44100;
+	codec.ch_in = 2;
+	codec.ch_out = 2;
+	codec.bit_rate = 128000;
+
+	while ((c = getopt(argc, argv, "hc:d:n:I:")) != -1) {
+		switch (c) {
+		case 'c':
+			card = strtol(optarg, NULL, 10);
+			break;
+		case 'd':
+			device = strtol(optarg, NULL, 10);
+			break;
+		case 'n':
+			iterations = strtol(optarg, NULL, 10);
+			break;
+		case 'I':
+			codec.id = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!iterations)
+		usage();
+
+	/* use driver defaults */
+	config.fragment_size = 0;
+	config.fragments = 0;
+	config.codec = &codec;
+
+	compress = compress_open(card, device, COMPRESS_IN, &config);
+	if (!compress || !is_compress_ready(compress)) {
+		fprintf(stderr, "Unable to open Compress device %d:%d\n",
+				card, device);
+		fprintf(stderr, "ERR: %s\n", compress_get_error(compress));
+		exit(EXIT_FAILURE);
+	}
+
+	/* errors are fine, an idle stream may not report a timestamp */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++)
+		compress_get_hpointer(compress, &avail, &tstamp);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	avail_ns = elapsed_ns(&start, &end) / iterations;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++)
+		compress_get_tstamp(compress, &samples, &rate);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	tstamp_ns = elapsed_ns(&start, &end) / iterations;
+
+	printf("%u calls per query\n", iterations);
+	printf("compress_get_hpointer: %.1f ns/call\n", avail_ns);
+	printf("compress_get_tstamp: %.1f ns/call\n", tstamp_ns);
+
+	compress_close(compress);
+	exit(EXIT_SUCCESS);
+}
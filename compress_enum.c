@@ -0,0 +1,259 @@
+/* compress_enum.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#define __force
+#define __bitwise
+#define __user
+#include "sound/compress_params.h"
+#include "sound/compress_offload.h"
+#include "tinycompress/tinycompress.h"
+#include "compress_enum.h"
+#include "snd_utils.h"
+
+/* range probed for plugin nodes, which have no /dev/snd entry */
+#define ENUM_MAX_CARDS		128
+#define ENUM_MAX_DEVICES	64
+
+#define ENUM_DEFAULT_THREADS	4
+
+struct compress_enum_slot {
+	unsigned int card;
+	unsigned int device;
+	/* results for COMPRESS_IN and COMPRESS_OUT */
+	int ret[2];
+	bool plugin[2];
+	struct snd_compr_caps caps[2];
+};
+
+struct compress_enum {
+	struct compress_enum_slot *slots;
+	unsigned int num_slots;
+	unsigned int max_slots;
+	atomic_uint next;
+};
+
+static int compress_enum_add(struct compress_enum *e, unsigned int card,
+		unsigned int device)
+{
+	struct compress_enum_slot *slots;
+	unsigned int i;
+
+	for (i = 0; i < e->num_slots; i++) {
+		if (e->slots[i].card == card && e->slots[i].device == device)
+			return 0;
+	}
+
+	if (e->num_slots == e->max_slots) {
+		slots = realloc(e->slots, (e->max_slots * 2 + 16) *
+				sizeof(*slots));
+		if (!slots)
+			return -ENOMEM;
+		e->slots = slots;
+		e->max_slots = e->max_slots * 2 + 16;
+	}
+
+	memset(&e->slots[e->num_slots], 0, sizeof(*e->slots));
+	e->slots[e->num_slots].card = card;
+	e->slots[e->num_slots].device = device;
+	e->num_slots++;
+	return 0;
+}
+
+/* Kernel devices are the comprC<card>D<device> nodes under /dev/snd */
+static int compress_enum_find_hw(struct compress_enum *e)
+{
+	struct dirent *entry;
+	unsigned int card, device;
+	DIR *dir;
+	int ret = 0;
+
+	dir = opendir("/dev/snd");
+	if (!dir)
+		return 0;
+
+	while (!ret && (entry = readdir(dir))) {
+		if (sscanf(entry->d_name, "comprC%uD%u", &card, &device) == 2)
+			ret = compress_enum_add(e, card, device);
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+#ifdef COMPRESS_HW_ONLY
+static int compress_enum_find_plugins(
+		struct compress_enum *e __attribute__((unused)))
+{
+	return 0;
+}
+#else
+/* Plugin devices are only known to the card definitions */
+static int compress_enum_find_plugins(struct compress_enum *e)
+{
+	struct snd_node *node;
+	unsigned int card, device;
+	int ret = 0;
+
+	for (card = 0; !ret && card < ENUM_MAX_CARDS; card++) {
+		for (device = 0; !ret && device < ENUM_MAX_DEVICES; device++) {
+			node = snd_utils_get_dev_node(card, device,
+					NODE_COMPRESS);
+			if (!node)
+				continue;
+			if (snd_utils_get_node_type(node) ==
+					SND_NODE_TYPE_PLUGIN)
+				ret = compress_enum_add(e, card, device);
+			snd_utils_put_dev_node(node);
+		}
+	}
+	return ret;
+}
+#endif
+
+static int compress_enum_cmp(const void *a, const void *b)
+{
+	const struct compress_enum_slot *sa = a, *sb = b;
+
+	if (sa->card != sb->card)
+		return sa->card < sb->card ? -1 : 1;
+	if (sa->device != sb->device)
+		return sa->device < sb->device ? -1 : 1;
+	return 0;
+}
+
+static void *compress_enum_worker(void *arg)
+{
+	static const unsigned int dirs[2] = { COMPRESS_IN, COMPRESS_OUT };
+	struct compress_enum *e = arg;
+	struct compress_enum_slot *slot;
+	unsigned int i, d;
+
+	while ((i = atomic_fetch_add(&e->next, 1)) < e->num_slots) {
+		slot = &e->slots[i];
+		for (d = 0; d < 2; d++)
+			slot->ret[d] = compress_enum_query_device(slot->card,
+					slot->device, dirs[d], &slot->caps[d],
+					&slot->plugin[d]);
+	}
+	return NULL;
+}
+
+static void compress_enum_fill(struct compress_device_info *info,
+		const struct compress_enum_slot *slot, unsigned int d)
+{
+	const struct snd_compr_caps *caps = &slot->caps[d];
+	unsigned int i;
+
+	memset(info, 0, sizeof(*info));
+	info->card = slot->card;
+	info->device = slot->device;
+	info->flags = d ? COMPRESS_OUT : COMPRESS_IN;
+	info->plugin = slot->plugin[d];
+	info->min_fragment_size = caps->min_fragment_size;
+	info->max_fragment_size = caps->max_fragment_size;
+	info->min_fragments = caps->min_fragments;
+	info->max_fragments = caps->max_fragments;
+	for (i = 0; i < caps->num_codecs; i++) {
+		if (caps->codecs[i] < 64)
+			info->codecs |= 1ULL << caps->codecs[i];
+	}
+}
+
+const struct compress_device_table *compress_enumerate_devices(
+		unsigned int threads)
+{
+	struct compress_enum e = { 0 };
+	struct compress_device_table *table = NULL;
+	pthread_t *tids = NULL;
+	unsigned int i, d, n, started = 0;
+
+	if (compress_enum_find_hw(&e) || compress_enum_find_plugins(&e))
+		goto out;
+
+	if (e.num_slots)
+		qsort(e.slots, e.num_slots, sizeof(*e.slots),
+				compress_enum_cmp);
+
+	if (!threads)
+		threads = ENUM_DEFAULT_THREADS;
+	if (threads > e.num_slots)
+		threads = e.num_slots ? e.num_slots : 1;
+
+	/* the calling thread is one of the workers */
+	if (threads > 1)
+		tids = calloc(threads - 1, sizeof(*tids));
+	for (i = 0; tids && i < threads - 1; i++) {
+		if (pthread_create(&tids[i], NULL, compress_enum_worker, &e))
+			break;
+		started++;
+	}
+	compress_enum_worker(&e);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	for (i = 0, n = 0; i < e.num_slots; i++)
+		n += !e.slots[i].ret[0] + !e.slots[i].ret[1];
+
+	table = calloc(1, sizeof(*table) + n * sizeof(table->devices[0]));
+	if (!table)
+		goto out;
+
+	for (i = 0; i < e.num_slots; i++) {
+		for (d = 0; d < 2; d++) {
+			if (!e.slots[i].ret[d])
+				compress_enum_fill(
+					&table->devices[table->num_devices++],
+					&e.slots[i], d);
+		}
+	}
+
+out:
+	if (!table)
+		errno = ENOMEM;
+	free(tids);
+	free(e.slots);
+	return table;
+}
+
+void compress_free_device_table(const struct compress_device_table *table)
+{
+	free((void *)table);
+}
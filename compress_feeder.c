@@ -0,0 +1,466 @@
+/* compress_feeder.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/futex.h>
+#include <linux/types.h>
+
+#include "tinycompress/tinycompress.h"
+#include "compress_feeder.h"
+
+/* How long the feeder waits before retrying a device that took no data */
+#define COMPR_FEEDER_RETRY_MS	100
+
+enum {
+	FEEDER_WAIT_EMPTY,
+	FEEDER_WAIT_FED,
+	FEEDER_WAIT_DISCARD,
+};
+
+struct compress_feeder {
+	char *buf;
+	size_t size;
+	size_t mask;
+
+	/* head is only written by the producer, tail by the feeder thread */
+	atomic_size_t head;
+	atomic_size_t tail;
+	/* tail at the last discard, to tell whether anything was fed since */
+	atomic_size_t fed_mark;
+
+	/* futex words the feeder thread and the producer sleep on */
+	atomic_int wake_seq;
+	atomic_int feeder_waiting;
+	atomic_int progress_seq;
+	atomic_int producer_waiting;
+
+	atomic_int exit;
+	atomic_int discard;
+	atomic_int error;
+
+	atomic_size_t max_occupancy;
+	atomic_ulong producer_stalls;
+	atomic_ulong stalled_bytes;
+	atomic_ullong bytes_fed;
+
+	compress_feeder_write_fn write_fn;
+	void *ctx;
+	int cpu;
+	pthread_t thread;
+};
+
+static void feeder_futex_wait(atomic_int *addr, int val, int timeout_ms)
+{
+	struct timespec ts, *pts = NULL;
+
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		pts = &ts;
+	}
+	syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, val, pts, NULL, 0);
+}
+
+static void feeder_futex_wake(atomic_int *addr)
+{
+	syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * The waiter publishes its waiting flag before checking its condition
+ * and the waker updates the condition before checking the flag, so one
+ * of them always sees the other and the syscall is only made when
+ * somebody actually sleeps.
+ */
+static void feeder_wake_thread(struct compress_feeder *feeder)
+{
+	if (atomic_load(&feeder->feeder_waiting)) {
+		atomic_fetch_add(&feeder->wake_seq, 1);
+		feeder_futex_wake(&feeder->wake_seq);
+	}
+}
+
+static void feeder_wake_producer(struct compress_feeder *feeder)
+{
+	if (atomic_load(&feeder->producer_waiting)) {
+		atomic_fetch_add(&feeder->progress_seq, 1);
+		feeder_futex_wake(&feeder->progress_seq);
+	}
+}
+
+static void feeder_set_affinity(struct compress_feeder *feeder)
+{
+	cpu_set_t set;
+
+	if (feeder->cpu < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(feeder->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		fprintf(stderr, "%s: cannot bind feeder to cpu %d: %s\n",
+				__func__, feeder->cpu, strerror(errno));
+}
+
+static void *compress_feeder_thread(void *arg)
+{
+	struct compress_feeder *feeder = arg;
+	size_t head, tail, off, len;
+	int blocked = 0, seq, ret;
+
+	feeder_set_affinity(feeder);
+
+	while (!atomic_load(&feeder->exit)) {
+		/* any kick from here on cuts the wait below short */
+		seq = atomic_load(&feeder->wake_seq);
+
+		if (atomic_load(&feeder->discard)) {
+			head = atomic_load_explicit(&feeder->head,
+					memory_order_acquire);
+			atomic_store_explicit(&feeder->tail, head,
+					memory_order_release);
+			atomic_store(&feeder->fed_mark, head);
+			atomic_store(&feeder->discard, 0);
+			feeder_wake_producer(feeder);
+			blocked = 0;
+			continue;
+		}
+
+		head = atomic_load_explicit(&feeder->head, memory_order_acquire);
+		tail = atomic_load_explicit(&feeder->tail, memory_order_relaxed);
+
+		if (blocked || (head == tail)) {
+			atomic_store(&feeder->feeder_waiting, 1);
+			if (!atomic_load(&feeder->exit) &&
+			    !atomic_load(&feeder->discard) &&
+			    (blocked || (atomic_load(&feeder->head) == tail)))
+				feeder_futex_wait(&feeder->wake_seq, seq,
+					blocked ? COMPR_FEEDER_RETRY_MS : -1);
+			atomic_store(&feeder->feeder_waiting, 0);
+			blocked = 0;
+			continue;
+		}
+
+		/* move the contiguous part, the wrapped part goes next round */
+		off = tail & feeder->mask;
+		len = head - tail;
+		if (len > feeder->size - off)
+			len = feeder->size - off;
+
+		ret = feeder->write_fn(feeder->ctx, feeder->buf + off, len);
+		if (ret < 0) {
+			atomic_store(&feeder->error, ret);
+			blocked = 1;
+		} else if (ret == 0) {
+			blocked = 1;
+		} else {
+			atomic_store_explicit(&feeder->tail, tail + ret,
+					memory_order_release);
+			atomic_fetch_add_explicit(&feeder->bytes_fed, ret,
+					memory_order_relaxed);
+		}
+		feeder_wake_producer(feeder);
+	}
+
+	return NULL;
+}
+
+static size_t feeder_roundup_pow2(size_t size)
+{
+	size_t ring = 1;
+
+	while (ring < size)
+		ring <<= 1;
+	return ring;
+}
+
+struct compress_feeder *compress_feeder_create(size_t ring_size,
+		int sched_policy, int sched_priority, int cpu,
+		compress_feeder_write_fn write_fn, void *ctx)
+{
+	struct compress_feeder *feeder;
+	struct sched_param param;
+	pthread_attr_t attr;
+	int ret;
+
+	if (!ring_size || (ring_size > (SIZE_MAX >> 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	feeder = calloc(1, sizeof(*feeder));
+	if (!feeder)
+		return NULL;
+
+	feeder->size = feeder_roundup_pow2(ring_size);
+	feeder->mask = feeder->size - 1;
+	feeder->buf = malloc(feeder->size);
+	if (!feeder->buf)
+		goto err_buf;
+
+	feeder->write_fn = write_fn;
+	feeder->ctx = ctx;
+	feeder->cpu = cpu;
+
+	pthread_attr_init(&attr);
+	if (sched_policy != SCHED_OTHER) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = sched_priority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, sched_policy);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	ret = pthread_create(&feeder->thread, &attr, compress_feeder_thread,
+			feeder);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		errno = ret;
+		goto err_thread;
+	}
+
+	return feeder;
+
+err_thread:
+	free(feeder->buf);
+err_buf:
+	free(feeder);
+	return NULL;
+}
+
+void compress_feeder_destroy(struct compress_feeder *feeder)
+{
+	if (!feeder)
+		return;
+
+	atomic_store(&feeder->exit, 1);
+	atomic_fetch_add(&feeder->wake_seq, 1);
+	feeder_futex_wake(&feeder->wake_seq);
+	pthread_join(feeder->thread, NULL);
+
+	free(feeder->buf);
+	free(feeder);
+}
+
+void compress_feeder_acquire(struct compress_feeder *feeder,
+		void **buf, size_t *size)
+{
+	size_t head, tail, off, space;
+
+	head = atomic_load_explicit(&feeder->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&feeder->tail, memory_order_acquire);
+	off = head & feeder->mask;
+	space = feeder->size - (head - tail);
+
+	*buf = feeder->buf + off;
+	*size = space < feeder->size - off ? space : feeder->size - off;
+	if (!*size)
+		atomic_fetch_add_explicit(&feeder->producer_stalls, 1,
+				memory_order_relaxed);
+}
+
+void compress_feeder_publish(struct compress_feeder *feeder, size_t size)
+{
+	size_t head, used;
+
+	if (!size)
+		return;
+
+	head = atomic_load_explicit(&feeder->head, memory_order_relaxed) + size;
+	atomic_store(&feeder->head, head);
+
+	used = head - atomic_load_explicit(&feeder->tail, memory_order_relaxed);
+	if (used > atomic_load_explicit(&feeder->max_occupancy,
+					memory_order_relaxed))
+		atomic_store_explicit(&feeder->max_occupancy, used,
+				memory_order_relaxed);
+
+	feeder_wake_thread(feeder);
+}
+
+size_t compress_feeder_push(struct compress_feeder *feeder,
+		const void *buf, size_t size)
+{
+	size_t head, tail, off, space, len, first;
+
+	head = atomic_load_explicit(&feeder->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&feeder->tail, memory_order_acquire);
+	space = feeder->size - (head - tail);
+	len = size < space ? size : space;
+
+	if (len < size) {
+		atomic_fetch_add_explicit(&feeder->producer_stalls, 1,
+				memory_order_relaxed);
+		atomic_fetch_add_explicit(&feeder->stalled_bytes, size - len,
+				memory_order_relaxed);
+	}
+
+	off = head & feeder->mask;
+	first = feeder->size - off;
+	if (first > len)
+		first = len;
+	memcpy(feeder->buf + off, buf, first);
+	memcpy(feeder->buf, (const char *)buf + first, len - first);
+
+	compress_feeder_publish(feeder, len);
+	return len;
+}
+
+void compress_feeder_kick(struct compress_feeder *feeder)
+{
+	atomic_fetch_add(&feeder->wake_seq, 1);
+	feeder_futex_wake(&feeder->wake_seq);
+}
+
+static bool feeder_wait_done(struct compress_feeder *feeder, int cond)
+{
+	size_t tail = atomic_load(&feeder->tail);
+
+	switch (cond) {
+	case FEEDER_WAIT_FED:
+		if (tail != atomic_load(&feeder->fed_mark))
+			return true;
+		/* fall through */
+	case FEEDER_WAIT_EMPTY:
+		return atomic_load(&feeder->head) == tail;
+	default:
+		return !atomic_load(&feeder->discard);
+	}
+}
+
+static long feeder_elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+		(now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int feeder_wait(struct compress_feeder *feeder, int cond,
+		int timeout_ms)
+{
+	struct timespec start;
+	long remaining = -1;
+	int seq, ret = 0;
+	bool done;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	compress_feeder_kick(feeder);
+
+	for (;;) {
+		if (cond != FEEDER_WAIT_DISCARD) {
+			ret = atomic_exchange(&feeder->error, 0);
+			if (ret)
+				return ret;
+		}
+
+		if (timeout_ms >= 0) {
+			remaining = timeout_ms - feeder_elapsed_ms(&start);
+			if (remaining < 0)
+				remaining = 0;
+		}
+
+		seq = atomic_load(&feeder->progress_seq);
+		atomic_fetch_add(&feeder->producer_waiting, 1);
+		done = feeder_wait_done(feeder, cond);
+		if (!done && remaining)
+			feeder_futex_wait(&feeder->progress_seq, seq, remaining);
+		atomic_fetch_sub(&feeder->producer_waiting, 1);
+
+		if (done)
+			return 0;
+		if (!remaining)
+			return -ETIME;
+	}
+}
+
+int compress_feeder_sync(struct compress_feeder *feeder, int until_fed,
+		int timeout_ms)
+{
+	return feeder_wait(feeder,
+			until_fed ? FEEDER_WAIT_FED : FEEDER_WAIT_EMPTY,
+			timeout_ms);
+}
+
+int compress_feeder_discard(struct compress_feeder *feeder, int timeout_ms)
+{
+	atomic_store(&feeder->discard, 1);
+	return feeder_wait(feeder, FEEDER_WAIT_DISCARD, timeout_ms);
+}
+
+int compress_feeder_discarding(struct compress_feeder *feeder)
+{
+	return atomic_load_explicit(&feeder->discard, memory_order_relaxed);
+}
+
+int compress_feeder_fed(struct compress_feeder *feeder)
+{
+	return atomic_load(&feeder->tail) != atomic_load(&feeder->fed_mark);
+}
+
+int compress_feeder_get_error(struct compress_feeder *feeder)
+{
+	return atomic_exchange(&feeder->error, 0);
+}
+
+void compress_feeder_get_stats(struct compress_feeder *feeder,
+		struct compr_feeder_stats *stats)
+{
+	size_t head = atomic_load(&feeder->head);
+	size_t tail = atomic_load(&feeder->tail);
+
+	stats->ring_size = feeder->size;
+	stats->occupancy = head - tail;
+	stats->max_occupancy = atomic_load_explicit(&feeder->max_occupancy,
+			memory_order_relaxed);
+	stats->producer_stalls = atomic_load_explicit(&feeder->producer_stalls,
+			memory_order_relaxed);
+	stats->stalled_bytes = atomic_load_explicit(&feeder->stalled_bytes,
+			memory_order_relaxed);
+	stats->bytes_fed = atomic_load_explicit(&feeder->bytes_fed,
+			memory_order_relaxed);
+}
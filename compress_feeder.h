@@ -0,0 +1,93 @@
+/* compress_feeder.h
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#ifndef __COMPRESS_FEEDER_H__
+#define __COMPRESS_FEEDER_H__
+
+#include <stddef.h>
+
+struct compress_feeder;
+struct compr_feeder_stats;
+
+/*
+ * Called from the feeder thread to move data to the device. Returns the
+ * bytes consumed, 0 when the device can't take data right now (paused or
+ * poll timed out) and negative errno on error.
+ */
+typedef int (*compress_feeder_write_fn) (void *ctx, const void *buf,
+		size_t size);
+
+/*
+ * Create a single producer/single consumer ring of at least ring_size bytes
+ * and the thread draining it through write_fn. cpu < 0 leaves the affinity
+ * unchanged.
+ */
+struct compress_feeder *compress_feeder_create(size_t ring_size,
+		int sched_policy, int sched_priority, int cpu,
+		compress_feeder_write_fn write_fn, void *ctx);
+
+void compress_feeder_destroy(struct compress_feeder *feeder);
+
+/* Producer side: queue up to size bytes, returns the bytes queued */
+size_t compress_feeder_push(struct compress_feeder *feeder,
+		const void *buf, size_t size);
+
+/* Producer side: contiguous free space of the ring and its publication */
+void compress_feeder_acquire(struct compress_feeder *feeder,
+		void **buf, size_t *size);
+void compress_feeder_publish(struct compress_feeder *feeder, size_t size);
+
+/* Wake the feeder thread to retry a transfer, e.g. after resume */
+void compress_feeder_kick(struct compress_feeder *feeder);
+
+/*
+ * Wait until the ring is empty, or with until_fed until the feeder moved
+ * some data to the device. Returns 0, -ETIME on timeout or the pending
+ * feeder error.
+ */
+int compress_feeder_sync(struct compress_feeder *feeder, int until_fed,
+		int timeout_ms);
+
+/* Drop all queued data, used on stop */
+int compress_feeder_discard(struct compress_feeder *feeder, int timeout_ms);
+
+/* True while a discard is in progress, transfers should bail out */
+int compress_feeder_discarding(struct compress_feeder *feeder);
+
+/* True once the thread has written data since creation or the last discard */
+int compress_feeder_fed(struct compress_feeder *feeder);
+
+/* Return and clear the last error (negative errno) of the feeder thread */
+int compress_feeder_get_error(struct compress_feeder *feeder);
+
+void compress_feeder_get_stats(struct compress_feeder *feeder,
+		struct compr_feeder_stats *stats);
+
+#endif /* end of __COMPRESS_FEEDER_H__ */
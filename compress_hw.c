@@ -48,6 +48,7 @@ struct compress_hw_data {
 	unsigned int card;
 	unsigned int device;
 	unsigned int fd;
+	unsigned int flags;
 };
 
 static int compress_hw_poll(void *data, struct pollfd *fds,
@@ -73,6 +74,70 @@ static int compress_hw_read(void *data, void *buf, size_t size)
 	return read(hw_data->fd, buf, size);
 }
 
+static int compress_hw_writev(void *data, const struct iovec *iov, int iovcnt)
+{
+	struct compress_hw_data *hw_data = data;
+
+	return writev(hw_data->fd, iov, iovcnt);
+}
+
+static int compress_hw_readv(void *data, const struct iovec *iov, int iovcnt)
+{
+	struct compress_hw_data *hw_data = data;
+
+	return readv(hw_data->fd, iov, iovcnt);
+}
+
+static int compress_hw_get_poll_fd(void *data, short *events)
+{
+	struct compress_hw_data *hw_data = data;
+
+	*events = (hw_data->flags & COMPRESS_OUT) ? POLLIN : POLLOUT;
+	return hw_data->fd;
+}
+
+static int compress_hw_handle_revents(__unused void *data, short revents,
+		short *events)
+{
+	*events = revents;
+	return 0;
+}
+
+static int compress_hw_avail(void *data, struct snd_compr_avail *avail)
+{
+	struct compress_hw_data *hw_data = data;
+
+	return ioctl(hw_data->fd, SNDRV_COMPRESS_AVAIL, avail);
+}
+
+static int compress_hw_tstamp(void *data, struct snd_compr_tstamp *tstamp)
+{
+	struct compress_hw_data *hw_data = data;
+
+	return ioctl(hw_data->fd, SNDRV_COMPRESS_TSTAMP, tstamp);
+}
+
+static int compress_hw_start(void *data)
+{
+	struct compress_hw_data *hw_data = data;
+
+	return ioctl(hw_data->fd, SNDRV_COMPRESS_START);
+}
+
+static int compress_hw_stop(void *data)
+{
+	struct compress_hw_data *hw_data = data;
+
+	return ioctl(hw_data->fd, SNDRV_COMPRESS_STOP);
+}
+
+static int compress_hw_set_params(void *data, struct snd_compr_params *params)
+{
+	struct compress_hw_data *hw_data = data;
+
+	return ioctl(hw_data->fd, SNDRV_COMPRESS_SET_PARAMS, params);
+}
+
 static int compress_hw_ioctl(void *data, unsigned int cmd, ...)
 {
 	struct compress_hw_data *hw_data = data;
@@ -122,17 +187,32 @@ static int compress_hw_open(unsigned int card, unsigned int device,
 	hw_data->card = card;
 	hw_data->device = device;
 	hw_data->fd = fd;
+	hw_data->flags = flags;
 
 	*data = hw_data;
 
 	return fd;
 }
 
-struct compress_ops compr_hw_ops = {
+/* hw only builds compile this file into compress.c, see COMPRESS_OPS() */
+#ifdef COMPRESS_HW_ONLY
+static const struct compress_ops compr_hw_ops = {
+#else
+const struct compress_ops compr_hw_ops = {
+#endif
 	.open = compress_hw_open,
 	.close = compress_hw_close,
 	.ioctl = compress_hw_ioctl,
 	.read = compress_hw_read,
 	.write = compress_hw_write,
+	.readv = compress_hw_readv,
+	.writev = compress_hw_writev,
 	.poll = compress_hw_poll,
+	.get_poll_fd = compress_hw_get_poll_fd,
+	.handle_revents = compress_hw_handle_revents,
+	.avail = compress_hw_avail,
+	.tstamp = compress_hw_tstamp,
+	.start = compress_hw_start,
+	.stop = compress_hw_stop,
+	.set_params = compress_hw_set_params,
 };
@@ -0,0 +1,928 @@
+/* compress_loopback.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+/*
+ * In-memory compress device for tests and benchmarks on machines without
+ * a DSP, built as libcompress_loopback.so. Point a card definition at it
+ * (snd_card_def_loopback.c provides one) and compress_open() plays into
+ * a ring buffer which a simulated DSP drains at the stream bit rate.
+ * Capture streams are filled with silence at the same pace.
+ *
+ * The pace is read from the environment when the stream is configured:
+ *   COMPRESS_LOOPBACK_BIT_RATE	bit/s to move data at, default the codec
+ *				bit rate
+ *   COMPRESS_LOOPBACK_SPEED	multiple of real time, 0 moves data as soon
+ *				as there is room, default 1
+ *   COMPRESS_LOOPBACK_TRACE	consumption trace recorded on a device, see
+ *				compress_replay.h, replayed instead of the
+ *				bit rate and speed to reproduce its bursts
+ *				and stalls
+ *
+ * AVAIL and TSTAMP follow the simulated DSP position. poll() and the poll
+ * fd, a timerfd, report the stream ready once a fragment is available.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#include <sys/ioctl.h>
+#include <linux/ioctl.h>
+#include <sound/asound.h>
+#include "tinycompress/tinycompress.h"
+#include "tinycompress/compress_plugin.h"
+#include "sound/compress_offload.h"
+#include "compress_replay.h"
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+#define NSEC_PER_SEC	1000000000ULL
+#define NSEC_PER_MSEC	1000000ULL
+
+#define LOOPBACK_MIN_FRAGMENT_SIZE	4096
+#define LOOPBACK_MAX_FRAGMENT_SIZE	(256 * 1024)
+#define LOOPBACK_MIN_FRAGMENTS		2
+#define LOOPBACK_MAX_FRAGMENTS		8
+
+/* used when neither the codec nor the environment give one */
+#define LOOPBACK_DEFAULT_BIT_RATE	128000
+#define LOOPBACK_DEFAULT_SAMPLE_RATE	48000
+
+/* longest sleep of drain() and poll(), bounds how late they see a stop */
+#define LOOPBACK_SLEEP_SLICE_NS		(20 * NSEC_PER_MSEC)
+
+#define LOOPBACK_MAX_METADATA		8
+
+static const __u32 loopback_codecs[] = {
+	SND_AUDIOCODEC_PCM,
+	SND_AUDIOCODEC_MP3,
+	SND_AUDIOCODEC_AAC,
+	SND_AUDIOCODEC_VORBIS,
+	SND_AUDIOCODEC_FLAC,
+};
+
+struct loopback_stream {
+	pthread_mutex_t lock;
+	unsigned int flags;
+	int timer_fd;
+
+	struct snd_codec codec;
+	unsigned int fragment_size;
+	size_t buffer_size;
+	char *ring;
+
+	/* nominal rate for timestamps, and the paced one, 0 when unpaced */
+	unsigned long long bit_rate;
+	unsigned long long byte_rate;
+	/* paces the DSP instead of byte_rate when set */
+	struct compress_replay *replay;
+
+	bool running;
+	/* bytes consumed, or produced for capture, by the DSP */
+	uint64_t hw_bytes;
+	/* bytes written, or read for capture, by the application */
+	uint64_t app_bytes;
+	/* time up to which the DSP progress is accounted in hw_bytes */
+	uint64_t hw_time_ns;
+	/* replay: frames played, and running time before run_start_ns */
+	uint64_t hw_frames;
+	uint64_t run_ns;
+	uint64_t run_start_ns;
+
+	struct snd_compr_metadata metadata[LOOPBACK_MAX_METADATA];
+	unsigned int num_metadata;
+};
+
+static uint64_t loopback_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void loopback_sleep_until(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / NSEC_PER_SEC;
+	ts.tv_nsec = ns % NSEC_PER_SEC;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static bool loopback_is_playback(struct loopback_stream *lb)
+{
+	return !(lb->flags & COMPRESS_OUT);
+}
+
+/* bytes the application can write, or read for capture */
+static uint64_t loopback_avail(struct loopback_stream *lb)
+{
+	if (loopback_is_playback(lb))
+		return lb->buffer_size - (lb->app_bytes - lb->hw_bytes);
+	return lb->hw_bytes - lb->app_bytes;
+}
+
+/* bytes the DSP can move before it has to wait for the application */
+static uint64_t loopback_hw_room(struct loopback_stream *lb)
+{
+	return lb->buffer_size - loopback_avail(lb);
+}
+
+/* Advance the DSP to now, called with the lock held */
+static void loopback_update(struct loopback_stream *lb)
+{
+	uint64_t now, room, bytes;
+
+	if (!lb->running)
+		return;
+
+	now = loopback_now_ns();
+	room = loopback_hw_room(lb);
+	if (lb->replay) {
+		compress_replay_position(lb->replay,
+				lb->run_ns + now - lb->run_start_ns,
+				lb->hw_bytes + room, &lb->hw_bytes, &lb->hw_frames);
+		return;
+	}
+
+	if (!lb->byte_rate ||
+	    (now - lb->hw_time_ns >= room * NSEC_PER_SEC / lb->byte_rate)) {
+		/* caught up with the application, idle time is not banked */
+		lb->hw_bytes += room;
+		lb->hw_time_ns = now;
+		return;
+	}
+
+	/* whole bytes only, the remainder stays in hw_time_ns */
+	bytes = (now - lb->hw_time_ns) * lb->byte_rate / NSEC_PER_SEC;
+	lb->hw_bytes += bytes;
+	lb->hw_time_ns += bytes * NSEC_PER_SEC / lb->byte_rate;
+}
+
+/*
+ * Time at which the DSP has moved bytes more, with room for them. Only
+ * meaningful for a running stream, after loopback_update(). An unpaced
+ * DSP moves them as soon as they are written.
+ */
+static uint64_t loopback_time_of(struct loopback_stream *lb, uint64_t bytes)
+{
+	if (lb->replay)
+		return lb->run_start_ns - lb->run_ns +
+			compress_replay_time_of(lb->replay, lb->hw_bytes + bytes);
+	if (!lb->byte_rate)
+		return lb->hw_time_ns;
+
+	return lb->hw_time_ns +
+		(bytes * NSEC_PER_SEC + lb->byte_rate - 1) / lb->byte_rate;
+}
+
+/* Time at which a fragment is available, 0 when it already is */
+static uint64_t loopback_ready_time(struct loopback_stream *lb)
+{
+	uint64_t avail = loopback_avail(lb);
+
+	if (avail >= lb->fragment_size)
+		return 0;
+	return loopback_time_of(lb, lb->fragment_size - avail);
+}
+
+/*
+ * Make the poll fd readable once a fragment is available, disarm it while
+ * the DSP is stopped. Called with the lock held after any change.
+ */
+static void loopback_arm(struct loopback_stream *lb)
+{
+	struct itimerspec its;
+	uint64_t when;
+
+	memset(&its, 0, sizeof(its));
+	if (lb->running) {
+		/* a time in the past expires at once, zero would disarm */
+		when = loopback_ready_time(lb);
+		if (!when)
+			when = 1;
+		its.it_value.tv_sec = when / NSEC_PER_SEC;
+		its.it_value.tv_nsec = when % NSEC_PER_SEC;
+	}
+	timerfd_settime(lb->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void loopback_fill_tstamp64(struct loopback_stream *lb,
+		struct compress_plugin_tstamp64 *tstamp)
+{
+	unsigned int rate = lb->codec.sample_rate;
+
+	if (!rate)
+		rate = LOOPBACK_DEFAULT_SAMPLE_RATE;
+
+	memset(tstamp, 0, sizeof(*tstamp));
+	tstamp->sampling_rate = rate;
+	if (!lb->buffer_size)
+		return;
+
+	tstamp->byte_offset = lb->hw_bytes % lb->buffer_size;
+	tstamp->copied_total = lb->hw_bytes;
+	if (lb->replay)
+		tstamp->pcm_frames = lb->hw_frames;
+	else
+		tstamp->pcm_frames = lb->hw_bytes * 8 * rate / lb->bit_rate;
+	tstamp->pcm_io_frames = tstamp->pcm_frames;
+}
+
+static void loopback_fill_tstamp(struct loopback_stream *lb,
+		struct snd_compr_tstamp *tstamp)
+{
+	struct compress_plugin_tstamp64 tstamp64;
+
+	loopback_fill_tstamp64(lb, &tstamp64);
+	tstamp->byte_offset = tstamp64.byte_offset;
+	tstamp->copied_total = tstamp64.copied_total;
+	tstamp->pcm_frames = tstamp64.pcm_frames;
+	tstamp->pcm_io_frames = tstamp64.pcm_io_frames;
+	tstamp->sampling_rate = tstamp64.sampling_rate;
+}
+
+/* Pick the pace from the codec and the environment */
+static void loopback_set_rate(struct loopback_stream *lb)
+{
+	const char *env;
+	double speed = 1.0;
+
+	lb->bit_rate = lb->codec.bit_rate;
+	if (!lb->bit_rate && (lb->codec.id == SND_AUDIOCODEC_PCM))
+		lb->bit_rate = 16ULL * lb->codec.sample_rate * lb->codec.ch_in;
+
+	env = getenv("COMPRESS_LOOPBACK_BIT_RATE");
+	if (env && strtoull(env, NULL, 0))
+		lb->bit_rate = strtoull(env, NULL, 0);
+	if (!lb->bit_rate)
+		lb->bit_rate = LOOPBACK_DEFAULT_BIT_RATE;
+
+	env = getenv("COMPRESS_LOOPBACK_SPEED");
+	if (env)
+		speed = strtod(env, NULL);
+
+	lb->byte_rate = 0;
+	if (speed > 0) {
+		lb->byte_rate = lb->bit_rate / 8 * speed;
+		if (!lb->byte_rate)
+			lb->byte_rate = 1;
+	}
+}
+
+/* Copy into the ring at the application position, lock held */
+static size_t loopback_copy_in(struct loopback_stream *lb,
+		const void *buf, size_t size)
+{
+	size_t offset, chunk;
+	uint64_t avail = loopback_avail(lb);
+
+	if (size > avail)
+		size = avail;
+	offset = lb->app_bytes % lb->buffer_size;
+	chunk = lb->buffer_size - offset;
+	if (chunk > size)
+		chunk = size;
+
+	memcpy(lb->ring + offset, buf, chunk);
+	memcpy(lb->ring, (const char *)buf + chunk, size - chunk);
+	lb->app_bytes += size;
+	return size;
+}
+
+/* Copy out of the ring at the application position, lock held */
+static size_t loopback_copy_out(struct loopback_stream *lb,
+		void *buf, size_t size)
+{
+	size_t offset, chunk;
+	uint64_t avail = loopback_avail(lb);
+
+	if (size > avail)
+		size = avail;
+	offset = lb->app_bytes % lb->buffer_size;
+	chunk = lb->buffer_size - offset;
+	if (chunk > size)
+		chunk = size;
+
+	memcpy(buf, lb->ring + offset, chunk);
+	memcpy((char *)buf + chunk, lb->ring, size - chunk);
+	lb->app_bytes += size;
+	return size;
+}
+
+/* Called with the lock held */
+static int loopback_store_metadata(struct loopback_stream *lb,
+		const struct snd_compr_metadata *metadata)
+{
+	unsigned int i;
+
+	for (i = 0; i < lb->num_metadata; i++) {
+		if (lb->metadata[i].key == metadata->key) {
+			lb->metadata[i] = *metadata;
+			return 0;
+		}
+	}
+	if (lb->num_metadata == LOOPBACK_MAX_METADATA)
+		return -ENOSPC;
+
+	lb->metadata[lb->num_metadata++] = *metadata;
+	return 0;
+}
+
+/* Called with the lock held */
+static int loopback_load_metadata(struct loopback_stream *lb,
+		struct snd_compr_metadata *metadata)
+{
+	unsigned int i;
+
+	for (i = 0; i < lb->num_metadata; i++) {
+		if (lb->metadata[i].key == metadata->key) {
+			*metadata = lb->metadata[i];
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static void loopback_close(struct compress_plugin *plugin)
+{
+	struct loopback_stream *lb = plugin->priv;
+
+	close(lb->timer_fd);
+	compress_replay_free(lb->replay);
+	pthread_mutex_destroy(&lb->lock);
+	free(lb->ring);
+	free(lb);
+	free(plugin);
+}
+
+static int loopback_get_caps(struct compress_plugin *plugin,
+		struct snd_compr_caps *caps)
+{
+	struct loopback_stream *lb = plugin->priv;
+	unsigned int i;
+
+	memset(caps, 0, sizeof(*caps));
+	caps->direction = loopback_is_playback(lb) ?
+			SND_COMPRESS_PLAYBACK : SND_COMPRESS_CAPTURE;
+	caps->min_fragment_size = LOOPBACK_MIN_FRAGMENT_SIZE;
+	caps->max_fragment_size = LOOPBACK_MAX_FRAGMENT_SIZE;
+	caps->min_fragments = LOOPBACK_MIN_FRAGMENTS;
+	caps->max_fragments = LOOPBACK_MAX_FRAGMENTS;
+	caps->num_codecs = ARRAY_SIZE(loopback_codecs);
+	for (i = 0; i < ARRAY_SIZE(loopback_codecs); i++)
+		caps->codecs[i] = loopback_codecs[i];
+
+	return 0;
+}
+
+static int loopback_set_params(struct compress_plugin *plugin,
+		struct snd_compr_params *params)
+{
+	struct loopback_stream *lb = plugin->priv;
+	struct snd_compressed_buffer *buffer = &params->buffer;
+	size_t buffer_size;
+	unsigned int i;
+	char *ring;
+
+	for (i = 0; i < ARRAY_SIZE(loopback_codecs); i++) {
+		if (params->codec.id == loopback_codecs[i])
+			break;
+	}
+	if (i == ARRAY_SIZE(loopback_codecs))
+		return -EINVAL;
+
+	if ((buffer->fragment_size < LOOPBACK_MIN_FRAGMENT_SIZE) ||
+	    (buffer->fragment_size > LOOPBACK_MAX_FRAGMENT_SIZE) ||
+	    (buffer->fragments < LOOPBACK_MIN_FRAGMENTS) ||
+	    (buffer->fragments > LOOPBACK_MAX_FRAGMENTS))
+		return -EINVAL;
+	buffer_size = (size_t)buffer->fragment_size * buffer->fragments;
+
+	pthread_mutex_lock(&lb->lock);
+	loopback_update(lb);
+	if (buffer_size != lb->buffer_size) {
+		/* the ring can only be resized while it is empty */
+		if (lb->app_bytes || lb->hw_bytes) {
+			pthread_mutex_unlock(&lb->lock);
+			return -EBUSY;
+		}
+		ring = calloc(1, buffer_size);
+		if (!ring) {
+			pthread_mutex_unlock(&lb->lock);
+			return -ENOMEM;
+		}
+		free(lb->ring);
+		lb->ring = ring;
+		lb->buffer_size = buffer_size;
+	}
+	lb->fragment_size = buffer->fragment_size;
+	lb->codec = params->codec;
+	loopback_set_rate(lb);
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+static int loopback_avail_op(struct compress_plugin *plugin,
+		struct snd_compr_avail *avail)
+{
+	struct loopback_stream *lb = plugin->priv;
+
+	pthread_mutex_lock(&lb->lock);
+	loopback_update(lb);
+	avail->avail = loopback_avail(lb);
+	loopback_fill_tstamp(lb, &avail->tstamp);
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+static int loopback_tstamp(struct compress_plugin *plugin,
+		struct snd_compr_tstamp *tstamp)
+{
+	struct loopback_stream *lb = plugin->priv;
+
+	pthread_mutex_lock(&lb->lock);
+	loopback_update(lb);
+	loopback_fill_tstamp(lb, tstamp);
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+static int loopback_tstamp64(struct compress_plugin *plugin,
+		struct compress_plugin_tstamp64 *tstamp)
+{
+	struct loopback_stream *lb = plugin->priv;
+
+	pthread_mutex_lock(&lb->lock);
+	loopback_update(lb);
+	loopback_fill_tstamp64(lb, tstamp);
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+static int loopback_write(struct compress_plugin *plugin,
+		const void *buf, size_t size)
+{
+	struct loopback_stream *lb = plugin->priv;
+	size_t written;
+
+	if (!loopback_is_playback(lb))
+		return -EINVAL;
+
+	pthread_mutex_lock(&lb->lock);
+	if (!lb->ring) {
+		pthread_mutex_unlock(&lb->lock);
+		return -EBADFD;
+	}
+	loopback_update(lb);
+	written = loopback_copy_in(lb, buf, size);
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return written;
+}
+
+static int loopback_writev(struct compress_plugin *plugin,
+		const struct iovec *iov, int iovcnt)
+{
+	struct loopback_stream *lb = plugin->priv;
+	size_t written, total = 0;
+	int i;
+
+	if (!loopback_is_playback(lb))
+		return -EINVAL;
+
+	pthread_mutex_lock(&lb->lock);
+	if (!lb->ring) {
+		pthread_mutex_unlock(&lb->lock);
+		return -EBADFD;
+	}
+	loopback_update(lb);
+	for (i = 0; i < iovcnt; i++) {
+		written = loopback_copy_in(lb, iov[i].iov_base, iov[i].iov_len);
+		total += written;
+		if (written < iov[i].iov_len)
+			break;
+	}
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return total;
+}
+
+static int loopback_read(struct compress_plugin *plugin,
+		void *buf, size_t size)
+{
+	struct loopback_stream *lb = plugin->priv;
+	size_t copied;
+
+	if (loopback_is_playback(lb))
+		return -EINVAL;
+
+	pthread_mutex_lock(&lb->lock);
+	if (!lb->ring) {
+		pthread_mutex_unlock(&lb->lock);
+		return -EBADFD;
+	}
+	loopback_update(lb);
+	copied = loopback_copy_out(lb, buf, size);
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return copied;
+}
+
+static int loopback_readv(struct compress_plugin *plugin,
+		const struct iovec *iov, int iovcnt)
+{
+	struct loopback_stream *lb = plugin->priv;
+	size_t copied, total = 0;
+	int i;
+
+	if (loopback_is_playback(lb))
+		return -EINVAL;
+
+	pthread_mutex_lock(&lb->lock);
+	if (!lb->ring) {
+		pthread_mutex_unlock(&lb->lock);
+		return -EBADFD;
+	}
+	loopback_update(lb);
+	for (i = 0; i < iovcnt; i++) {
+		copied = loopback_copy_out(lb, iov[i].iov_base, iov[i].iov_len);
+		total += copied;
+		if (copied < iov[i].iov_len)
+			break;
+	}
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return total;
+}
+
+static int loopback_get_buffer(struct compress_plugin *plugin,
+		void **buf, size_t *size)
+{
+	struct loopback_stream *lb = plugin->priv;
+	size_t offset, contig;
+	uint64_t avail;
+
+	if (!loopback_is_playback(lb))
+		return -EINVAL;
+
+	pthread_mutex_lock(&lb->lock);
+	if (!lb->ring) {
+		pthread_mutex_unlock(&lb->lock);
+		return -EBADFD;
+	}
+	loopback_update(lb);
+	avail = loopback_avail(lb);
+	offset = lb->app_bytes % lb->buffer_size;
+	contig = lb->buffer_size - offset;
+	*buf = lb->ring + offset;
+	*size = avail < contig ? avail : contig;
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+static int loopback_commit(struct compress_plugin *plugin, size_t size)
+{
+	struct loopback_stream *lb = plugin->priv;
+	int ret = 0;
+
+	pthread_mutex_lock(&lb->lock);
+	loopback_update(lb);
+	if (!lb->ring || (size > loopback_avail(lb)))
+		ret = -EINVAL;
+	else
+		lb->app_bytes += size;
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return ret;
+}
+
+static int loopback_start(struct compress_plugin *plugin)
+{
+	struct loopback_stream *lb = plugin->priv;
+
+	pthread_mutex_lock(&lb->lock);
+	lb->running = true;
+	lb->hw_time_ns = loopback_now_ns();
+	lb->run_start_ns = lb->hw_time_ns;
+	loopback_update(lb);
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+static int loopback_stop(struct compress_plugin *plugin)
+{
+	struct loopback_stream *lb = plugin->priv;
+
+	/* like the kernel, drop whatever is still queued */
+	pthread_mutex_lock(&lb->lock);
+	lb->running = false;
+	lb->hw_bytes = 0;
+	lb->app_bytes = 0;
+	lb->hw_frames = 0;
+	lb->run_ns = 0;
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+static int loopback_pause(struct compress_plugin *plugin)
+{
+	struct loopback_stream *lb = plugin->priv;
+
+	pthread_mutex_lock(&lb->lock);
+	loopback_update(lb);
+	if (lb->running)
+		lb->run_ns += loopback_now_ns() - lb->run_start_ns;
+	lb->running = false;
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+static int loopback_resume(struct compress_plugin *plugin)
+{
+	struct loopback_stream *lb = plugin->priv;
+
+	pthread_mutex_lock(&lb->lock);
+	lb->running = true;
+	lb->hw_time_ns = loopback_now_ns();
+	lb->run_start_ns = lb->hw_time_ns;
+	loopback_update(lb);
+	loopback_arm(lb);
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+/* Wait until the DSP consumed everything written, or the stream stops */
+static int loopback_drain(struct compress_plugin *plugin)
+{
+	struct loopback_stream *lb = plugin->priv;
+	uint64_t until, slice;
+
+	if (!loopback_is_playback(lb))
+		return 0;
+
+	pthread_mutex_lock(&lb->lock);
+	for (;;) {
+		loopback_update(lb);
+		if (!lb->running || (lb->hw_bytes == lb->app_bytes))
+			break;
+
+		until = loopback_time_of(lb, lb->app_bytes - lb->hw_bytes);
+		slice = loopback_now_ns() + LOOPBACK_SLEEP_SLICE_NS;
+		pthread_mutex_unlock(&lb->lock);
+		loopback_sleep_until(until < slice ? until : slice);
+		pthread_mutex_lock(&lb->lock);
+	}
+	pthread_mutex_unlock(&lb->lock);
+
+	return 0;
+}
+
+/* Tracks are not told apart, the DSP plays through */
+static int loopback_next_track(struct compress_plugin *plugin __unused)
+{
+	return 0;
+}
+
+static int loopback_poll(struct compress_plugin *plugin,
+		struct pollfd *fds, nfds_t nfds __unused, int timeout)
+{
+	struct loopback_stream *lb = plugin->priv;
+	uint64_t now, when, deadline = 0;
+	short ready;
+	int ret = 0;
+
+	fds->revents = 0;
+	if (timeout > 0)
+		deadline = loopback_now_ns() + timeout * NSEC_PER_MSEC;
+
+	pthread_mutex_lock(&lb->lock);
+	for (;;) {
+		loopback_update(lb);
+		/* paused or stopped meanwhile */
+		if (!lb->running) {
+			ret = -EBADFD;
+			break;
+		}
+		ready = loopback_is_playback(lb) ? POLLOUT : POLLIN;
+		when = loopback_ready_time(lb);
+		if (!when && (fds->events & ready)) {
+			fds->revents = ready;
+			ret = 1;
+			break;
+		}
+
+		now = loopback_now_ns();
+		if (!timeout || (deadline && (now >= deadline)))
+			break;
+		/* not waiting for data, only a stop or the timeout end it */
+		if (!(fds->events & ready))
+			when = deadline ? deadline : now + LOOPBACK_SLEEP_SLICE_NS;
+		else if (deadline && (when > deadline))
+			when = deadline;
+		if (when > now + LOOPBACK_SLEEP_SLICE_NS)
+			when = now + LOOPBACK_SLEEP_SLICE_NS;
+
+		pthread_mutex_unlock(&lb->lock);
+		loopback_sleep_until(when);
+		pthread_mutex_lock(&lb->lock);
+	}
+	pthread_mutex_unlock(&lb->lock);
+
+	return ret;
+}
+
+static int loopback_ioctl(struct compress_plugin *plugin, int cmd, ...)
+{
+	struct loopback_stream *lb = plugin->priv;
+	va_list ap;
+	void *arg;
+	int ret;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	pthread_mutex_lock(&lb->lock);
+	switch ((unsigned int)cmd) {
+	case SNDRV_COMPRESS_SET_METADATA:
+		ret = loopback_store_metadata(lb, arg);
+		break;
+	case SNDRV_COMPRESS_GET_METADATA:
+		ret = loopback_load_metadata(lb, arg);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	pthread_mutex_unlock(&lb->lock);
+
+	return ret;
+}
+
+static int loopback_get_poll_fd(struct compress_plugin *plugin)
+{
+	struct loopback_stream *lb = plugin->priv;
+
+	return lb->timer_fd;
+}
+
+static int loopback_set_metadata(struct compress_plugin *plugin,
+		const struct snd_compr_metadata *metadata, unsigned int count)
+{
+	struct loopback_stream *lb = plugin->priv;
+	unsigned int i;
+	int ret = 0;
+
+	pthread_mutex_lock(&lb->lock);
+	for (i = 0; (i < count) && !ret; i++)
+		ret = loopback_store_metadata(lb, &metadata[i]);
+	pthread_mutex_unlock(&lb->lock);
+
+	return ret;
+}
+
+static struct compress_plugin_ops loopback_ops = {
+	.close = loopback_close,
+	.get_caps = loopback_get_caps,
+	.set_params = loopback_set_params,
+	.avail = loopback_avail_op,
+	.tstamp = loopback_tstamp,
+	.write = loopback_write,
+	.read = loopback_read,
+	.start = loopback_start,
+	.stop = loopback_stop,
+	.pause = loopback_pause,
+	.resume = loopback_resume,
+	.drain = loopback_drain,
+	.partial_drain = loopback_drain,
+	.next_track = loopback_next_track,
+	.ioctl = loopback_ioctl,
+	.poll = loopback_poll,
+	.get_buffer = loopback_get_buffer,
+	.commit = loopback_commit,
+	.writev = loopback_writev,
+	.readv = loopback_readv,
+	.get_poll_fd = loopback_get_poll_fd,
+	.tstamp64 = loopback_tstamp64,
+	.set_metadata = loopback_set_metadata,
+};
+
+COMPRESS_PLUGIN_OPEN_FN(compress_loopback)
+{
+	struct compress_plugin *compress_plugin;
+	struct loopback_stream *lb;
+	const char *trace;
+	int ret = -ENOMEM;
+
+	(void)device;
+
+	compress_plugin = calloc(1, sizeof(*compress_plugin));
+	lb = calloc(1, sizeof(*lb));
+	if (!compress_plugin || !lb)
+		goto err_alloc;
+
+	trace = getenv("COMPRESS_LOOPBACK_TRACE");
+	if (trace) {
+		lb->replay = compress_replay_load(trace);
+		if (!lb->replay) {
+			fprintf(stderr, "%s: can't replay %s: %s\n", __func__,
+					trace, strerror(errno));
+			ret = -errno;
+			goto err_alloc;
+		}
+	}
+
+	lb->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+			TFD_NONBLOCK | TFD_CLOEXEC);
+	if (lb->timer_fd < 0) {
+		ret = -errno;
+		goto err_timer;
+	}
+
+	pthread_mutex_init(&lb->lock, NULL);
+	lb->flags = flags;
+
+	compress_plugin->card = card;
+	compress_plugin->ops = &loopback_ops;
+	compress_plugin->priv = lb;
+	*plugin = compress_plugin;
+
+	return 0;
+
+err_timer:
+	compress_replay_free(lb->replay);
+err_alloc:
+	free(lb);
+	free(compress_plugin);
+	return ret;
+}
+
+COMPRESS_PLUGIN_GET_FEATURES_FN(compress_loopback)
+{
+	(void)version;
+
+	return COMPRESS_PLUGIN_FEATURE_IOV |
+		COMPRESS_PLUGIN_FEATURE_RING |
+		COMPRESS_PLUGIN_FEATURE_POLL_FD |
+		COMPRESS_PLUGIN_FEATURE_TSTAMP64 |
+		COMPRESS_PLUGIN_FEATURE_METADATA;
+}
+
+COMPRESS_PLUGIN_REGISTER_V2(compress_loopback)
@@ -0,0 +1,204 @@
+/* compress_open_bench.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+/*
+ * Measures compress_open()/compress_close() churn, as done by a HAL that
+ * reopens the offload stream on every track or routing change. Each
+ * thread opens and closes the device in a loop, the latency of every
+ * open/close pair is reported. Run it on builds before and after a change
+ * to the open path to compare.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <linux/types.h>
+#define __force
+#define __bitwise
+#define __user
+#include "sound/compress_params.h"
+#include "tinycompress/tinycompress.h"
+
+#define MAX_THREADS	64
+
+struct bench_thread {
+	pthread_t thread;
+	unsigned int card;
+	unsigned int device;
+	unsigned int iterations;
+	struct snd_codec *codec;
+	double *lat_us;
+	int failed;
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: compress_open_bench [OPTIONS]\n"
+		"-c\tcard number\n"
+		"-d\tdevice node\n"
+		"-n\topen/close iterations per thread (default 1000)\n"
+		"-t\tthreads (default 1)\n"
+		"-I\tcodec id (default MP3)\n"
+		"-h\tPrints this help list\n\n"
+		"Example:\n"
+		"\tcompress_open_bench -c 0 -d 1 -n 500 -t 4\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void *churn(void *arg)
+{
+	struct bench_thread *bt = arg;
+	struct compr_config config;
+	struct compress *compress;
+	struct timespec start, end;
+	unsigned int i;
+
+	for (i = 0; i < bt->iterations; i++) {
+		/* use driver defaults */
+		config.fragment_size = 0;
+		config.fragments = 0;
+		config.codec = bt->codec;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		compress = compress_open(bt->card, bt->device, COMPRESS_IN,
+				&config);
+		if (!compress || !is_compress_ready(compress)) {
+			fprintf(stderr, "Unable to open Compress device %d:%d\n",
+					bt->card, bt->device);
+			fprintf(stderr, "ERR: %s\n", compress_get_error(compress));
+			bt->failed = 1;
+			return NULL;
+		}
+		compress_close(compress);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		bt->lat_us[i] = (end.tv_sec - start.tv_sec) * 1000000.0 +
+			(end.tv_nsec - start.tv_nsec) / 1000.0;
+	}
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_thread threads[MAX_THREADS];
+	struct snd_codec codec;
+	struct timespec start, end;
+	unsigned int card = 0, device = 0, iterations = 1000, nthreads = 1;
+	unsigned int i, total;
+	double *lat_us, sum = 0, wall_ms;
+	int c;
+
+	memset(&codec, 0, sizeof(codec));
+	codec.id = SND_AUDIOCODEC_MP3;
+	codec.sample_rate = 44100;
+	codec.ch_in = 2;
+	codec.ch_out = 2;
+	codec.bit_rate = 128000;
+
+	while ((c = getopt(argc, argv, "hc:d:n:t:I:")) != -1) {
+		switch (c) {
+		case 'c':
+			card = strtol(optarg, NULL, 10);
+			break;
+		case 'd':
+			device = strtol(optarg, NULL, 10);
+			break;
+		case 'n':
+			iterations = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			nthreads = strtol(optarg, NULL, 10);
+			break;
+		case 'I':
+			codec.id = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!iterations || !nthreads || nthreads > MAX_THREADS)
+		usage();
+
+	total = iterations * nthreads;
+	lat_us = calloc(total, sizeof(*lat_us));
+	if (!lat_us) {
+		fprintf(stderr, "Unable to allocate %u samples\n", total);
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nthreads; i++) {
+		threads[i].card = card;
+		threads[i].device = device;
+		threads[i].iterations = iterations;
+		threads[i].codec = &codec;
+		threads[i].lat_us = lat_us + i * iterations;
+		threads[i].failed = 0;
+		if (pthread_create(&threads[i].thread, NULL, churn, &threads[i])) {
+			fprintf(stderr, "Unable to create thread %u\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].failed)
+			exit(EXIT_FAILURE);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	wall_ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+		(end.tv_nsec - start.tv_nsec) / 1000000.0;
+	qsort(lat_us, total, sizeof(*lat_us), cmp_double);
+	for (i = 0; i < total; i++)
+		sum += lat_us[i];
+
+	printf("%u threads x %u open/close: %.1f ms, %.0f opens/s\n",
+			nthreads, iterations, wall_ms, total * 1000.0 / wall_ms);
+	printf("open/close us: mean %.1f p50 %.1f p99 %.1f max %.1f\n",
+			sum / total, lat_us[total / 2], lat_us[total * 99 / 100],
+			lat_us[total - 1]);
+
+	free(lat_us);
+	exit(EXIT_SUCCESS);
+}
@@ -32,9 +32,11 @@
 #define __COMPRESS_H__
 
 #include <poll.h>
+#include <sys/uio.h>
 
 #include "sound/compress_params.h"
 #include "sound/compress_offload.h"
+#include "tinycompress/compress_plugin.h"
 
 struct compress_ops {
 	int (*open) (unsigned int card, unsigned int device,
@@ -43,8 +45,34 @@ struct compress_ops {
 	int (*ioctl) (void *data, unsigned int cmd, ...);
 	int (*read) (void *data, void *buf, size_t size);
 	int (*write) (void *data, const void *buf, size_t size);
+	int (*readv) (void *data, const struct iovec *iov, int iovcnt);
+	int (*writev) (void *data, const struct iovec *iov, int iovcnt);
 	int (*poll) (void *data, struct pollfd *fds, nfds_t nfds,
 				 int timeout);
+	/* optional direct ring access, return -ENOSYS when not supported */
+	int (*get_buffer) (void *data, void **buf, size_t *size);
+	int (*commit) (void *data, size_t size);
+	/*
+	 * optional pollable descriptor for external event loops, returns the
+	 * fd and the events to poll for, handle_revents translates what
+	 * poll() reported on it into POLLOUT/POLLIN/POLLERR of the stream
+	 */
+	int (*get_poll_fd) (void *data, short *events);
+	int (*handle_revents) (void *data, short revents, short *events);
+	/*
+	 * typed entry points of the commands on the hot path, same returns as
+	 * ioctl which is kept for the others
+	 */
+	int (*avail) (void *data, struct snd_compr_avail *avail);
+	int (*tstamp) (void *data, struct snd_compr_tstamp *tstamp);
+	int (*start) (void *data);
+	int (*stop) (void *data);
+	int (*set_params) (void *data, struct snd_compr_params *params);
+	/* optional, TSTAMP widened and SET_METADATA per key when not set */
+	int (*tstamp64) (void *data, struct compress_plugin_tstamp64 *tstamp);
+	int (*set_metadata) (void *data,
+			const struct snd_compr_metadata *metadata,
+			unsigned int count);
 };
 
 #endif /* end of __PCM_H__ */
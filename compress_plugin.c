@@ -31,6 +31,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <fcntl.h>
 #include <stdarg.h>
 #include <string.h>
@@ -38,17 +39,27 @@
 #include <unistd.h>
 #include <poll.h>
 #include <dlfcn.h>
+#include <pthread.h>
 
 #include <sys/ioctl.h>
 #include <linux/ioctl.h>
 #include <sound/asound.h>
+#include "tinycompress/tinycompress.h"
 #include "tinycompress/compress_plugin.h"
 #include "sound/compress_offload.h"
 #include "compress_ops.h"
+#include "compress_trace.h"
 #include "snd_utils.h"
 
 #define U32_MAX	((uint32_t)~0U)
 
+/* plugin features this library knows how to use */
+#define COMPRESS_PLUG_FEATURES	(COMPRESS_PLUGIN_FEATURE_IOV | \
+				 COMPRESS_PLUGIN_FEATURE_RING | \
+				 COMPRESS_PLUGIN_FEATURE_POLL_FD | \
+				 COMPRESS_PLUGIN_FEATURE_TSTAMP64 | \
+				 COMPRESS_PLUGIN_FEATURE_METADATA)
+
 enum {
 	COMPRESS_PLUG_STATE_OPEN,
 	COMPRESS_PLUG_STATE_SETUP,
@@ -57,19 +68,107 @@ enum {
 	COMPRESS_PLUG_STATE_RUNNING,
 };
 
+/*
+ * Loaded plugin library, shared by all streams using the same so-name.
+ * Libraries stay resident after their last stream is closed unless the
+ * unload policy says otherwise, so reopening skips the dynamic loader.
+ * Plugins linked into the process are registered with a NULL dl_hdl and
+ * are never unloaded. The features are negotiated once per library.
+ */
+struct compress_plug_lib {
+	struct compress_plug_lib *next;
+	char *so_name;
+	int refs;
+
+	void *dl_hdl;
+	COMPRESS_PLUGIN_OPEN_FN_PTR();
+	unsigned int features;
+};
+
+static pthread_mutex_t plug_lib_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct compress_plug_lib *plug_libs;
+static enum compress_plugin_policy plug_lib_policy =
+	COMPRESS_PLUGIN_KEEP_RESIDENT;
+
 struct compress_plug_data {
 	unsigned int card;
 	unsigned int device;
 	unsigned int fd;
 	unsigned int flags;
 
-	void *dl_hdl;
-	COMPRESS_PLUGIN_OPEN_FN_PTR();
+	struct compress_plug_lib *lib;
+	unsigned int features;
 
 	struct compress_plugin *plugin;
 	void *dev_node;
+#ifdef COMPRESS_TRACE
+	char trace_id[COMPRESS_TRACE_ID_MAX];
+#endif
 };
 
+static void compress_plug_set_state(struct compress_plug_data *plug_data,
+		int state)
+{
+	plug_data->plugin->state = state;
+	compress_trace_int(plug_data->trace_id, "compress_plug_state", state);
+}
+
+static inline bool compress_plug_has(struct compress_plug_data *plug_data,
+		unsigned int feature)
+{
+	return plug_data->features & feature;
+}
+
+static unsigned int compress_plug_negotiate(
+		unsigned int (*get_features_fn) (unsigned int version))
+{
+	/* version 1 plugins only have the base ops */
+	if (!get_features_fn)
+		return 0;
+
+	return get_features_fn(COMPRESS_PLUGIN_ABI_VERSION) &
+		COMPRESS_PLUG_FEATURES;
+}
+
+/*
+ * Drop the negotiated features whose ops the opened plugin left out, so
+ * the feature bits alone decide whether a version 2 op may be called.
+ * The ops table of a version 1 plugin ends at poll, a slot is only read
+ * when its feature was reported.
+ */
+static void compress_plug_check_features(struct compress_plug_data *plug_data)
+{
+	struct compress_plugin_ops *ops = plug_data->plugin->ops;
+	unsigned int *features = &plug_data->features;
+
+	if (!*features)
+		return;
+
+	if ((*features & COMPRESS_PLUGIN_FEATURE_RING) &&
+	    (!ops->get_buffer || !ops->commit))
+		*features &= ~COMPRESS_PLUGIN_FEATURE_RING;
+	if ((*features & COMPRESS_PLUGIN_FEATURE_IOV) &&
+	    (!ops->writev || !ops->readv))
+		*features &= ~COMPRESS_PLUGIN_FEATURE_IOV;
+	if ((*features & COMPRESS_PLUGIN_FEATURE_POLL_FD) && !ops->get_poll_fd)
+		*features &= ~COMPRESS_PLUGIN_FEATURE_POLL_FD;
+	if ((*features & COMPRESS_PLUGIN_FEATURE_TSTAMP64) && !ops->tstamp64)
+		*features &= ~COMPRESS_PLUGIN_FEATURE_TSTAMP64;
+	if ((*features & COMPRESS_PLUGIN_FEATURE_METADATA) && !ops->set_metadata)
+		*features &= ~COMPRESS_PLUGIN_FEATURE_METADATA;
+}
+
+/*
+ * The library reports errors, and its transfer and wait loops tell a
+ * pause from an error, by errno, as they get it from the hw ops
+ */
+static int compress_plug_errno(int ret)
+{
+	if (ret < 0)
+		errno = -ret;
+	return ret;
+}
+
 static int compress_plug_get_caps(struct compress_plug_data *plug_data,
 		struct snd_compr_caps *caps)
 {
@@ -78,81 +177,138 @@ static int compress_plug_get_caps(struct compress_plug_data *plug_data,
 	return plugin->ops->get_caps(plugin, caps);
 }
 
-static int compress_plug_set_params(struct compress_plug_data *plug_data,
+static int compress_plug_set_params(void *data,
 		struct snd_compr_params *params)
 {
+	struct compress_plug_data *plug_data = data;
 	struct compress_plugin *plugin = plug_data->plugin;
 	int rc;
 
 	if (plugin->state == COMPRESS_PLUG_STATE_RUNNING)
-		return plugin->ops->set_params(plugin, params);
+		return compress_plug_errno(plugin->ops->set_params(plugin,
+				params));
 	else if (plugin->state != COMPRESS_PLUG_STATE_OPEN &&
 		plugin->state != COMPRESS_PLUG_STATE_SETUP)
-		return -EBADFD;
+		return compress_plug_errno(-EBADFD);
 
 	if (params->buffer.fragment_size == 0 ||
 	   params->buffer.fragments > U32_MAX / params->buffer.fragment_size ||
 	   params->buffer.fragments == 0)
-		return -EINVAL;
+		return compress_plug_errno(-EINVAL);
 
 	rc = plugin->ops->set_params(plugin, params);
 	if (!rc)
-		plugin->state = COMPRESS_PLUG_STATE_SETUP;
+		compress_plug_set_state(plug_data, COMPRESS_PLUG_STATE_SETUP);
 
-	return rc;
+	return compress_plug_errno(rc);
 }
 
-static int compress_plug_avail(struct compress_plug_data *plug_data,
-		struct snd_compr_avail *avail)
+static int compress_plug_avail(void *data, struct snd_compr_avail *avail)
 {
+	struct compress_plug_data *plug_data = data;
 	struct compress_plugin *plugin = plug_data->plugin;
 
-	return plugin->ops->avail(plugin, avail);
+	return compress_plug_errno(plugin->ops->avail(plugin, avail));
 }
 
-static int compress_plug_tstamp(struct compress_plug_data *plug_data,
-		struct snd_compr_tstamp *tstamp)
+static int compress_plug_tstamp(void *data, struct snd_compr_tstamp *tstamp)
 {
+	struct compress_plug_data *plug_data = data;
 	struct compress_plugin *plugin = plug_data->plugin;
 
-	if (plugin->state != COMPRESS_PLUG_STATE_SETUP)
-		return -EBADFD;
+	/* the position is defined from set params on */
+	if (plugin->state == COMPRESS_PLUG_STATE_OPEN)
+		return compress_plug_errno(-EBADFD);
 
-	return plugin->ops->tstamp(plugin, tstamp);
+	return compress_plug_errno(plugin->ops->tstamp(plugin, tstamp));
 }
 
-static int compress_plug_start(struct compress_plug_data *plug_data)
+static int compress_plug_tstamp64(void *data,
+		struct compress_plugin_tstamp64 *tstamp)
 {
+	struct compress_plug_data *plug_data = data;
 	struct compress_plugin *plugin = plug_data->plugin;
+	struct snd_compr_tstamp tstamp32;
 	int rc;
 
-	/* for playback moved to prepare in first write */
-	/* for capture: move to prepare state set params */
-	 /* TODO: add direction in set params */
-	if (plugin->state != COMPRESS_PLUG_STATE_PREPARED)
-		return -EBADFD;
+	/* the position is defined from set params on */
+	if (plugin->state == COMPRESS_PLUG_STATE_OPEN)
+		return compress_plug_errno(-EBADFD);
+
+	if (compress_plug_has(plug_data, COMPRESS_PLUGIN_FEATURE_TSTAMP64))
+		return compress_plug_errno(plugin->ops->tstamp64(plugin,
+				tstamp));
+
+	rc = plugin->ops->tstamp(plugin, &tstamp32);
+	if (rc)
+		return compress_plug_errno(rc);
+	tstamp->byte_offset = tstamp32.byte_offset;
+	tstamp->copied_total = tstamp32.copied_total;
+	tstamp->pcm_frames = tstamp32.pcm_frames;
+	tstamp->pcm_io_frames = tstamp32.pcm_io_frames;
+	tstamp->sampling_rate = tstamp32.sampling_rate;
+	return 0;
+}
+
+static int compress_plug_set_metadata(void *data,
+		const struct snd_compr_metadata *metadata, unsigned int count)
+{
+	struct compress_plug_data *plug_data = data;
+	struct compress_plugin *plugin = plug_data->plugin;
+	unsigned int i;
+	int rc;
+
+	if (compress_plug_has(plug_data, COMPRESS_PLUGIN_FEATURE_METADATA))
+		return compress_plug_errno(plugin->ops->set_metadata(plugin,
+				metadata, count));
+
+	if (!plugin->ops->ioctl)
+		return compress_plug_errno(-EINVAL);
+	for (i = 0; i < count; i++) {
+		rc = plugin->ops->ioctl(plugin, SNDRV_COMPRESS_SET_METADATA,
+				&metadata[i]);
+		if (rc)
+			return compress_plug_errno(rc);
+	}
+	return 0;
+}
+
+static int compress_plug_start(void *data)
+{
+	struct compress_plug_data *plug_data = data;
+	struct compress_plugin *plugin = plug_data->plugin;
+	int rc;
+
+	/* playback moves to prepared on the first write, capture starts
+	 * right after set params
+	 */
+	if ((plugin->state != COMPRESS_PLUG_STATE_PREPARED) &&
+	    !((plug_data->flags & COMPRESS_OUT) &&
+	      (plugin->state == COMPRESS_PLUG_STATE_SETUP)))
+		return compress_plug_errno(-EBADFD);
 
 	rc = plugin->ops->start(plugin);
 	if (!rc)
-		plugin->state = COMPRESS_PLUG_STATE_RUNNING;
+		compress_plug_set_state(plug_data, COMPRESS_PLUG_STATE_RUNNING);
 
-	return rc;
+	return compress_plug_errno(rc);
 }
 
-static int compress_plug_stop(struct compress_plug_data *plug_data)
+static int compress_plug_stop(void *data)
 {
+	struct compress_plug_data *plug_data = data;
 	struct compress_plugin *plugin = plug_data->plugin;
 	int rc;
 
 	if (plugin->state == COMPRESS_PLUG_STATE_PREPARED ||
 		plugin->state == COMPRESS_PLUG_STATE_SETUP)
-		return -EBADFD;
+		return compress_plug_errno(-EBADFD);
 
 	rc = plugin->ops->stop(plugin);
 	if (!rc)
-		plugin->state = COMPRESS_PLUG_STATE_SETUP;
+		compress_plug_set_state(plug_data, COMPRESS_PLUG_STATE_SETUP);
 
-	return rc;
+	return compress_plug_errno(rc);
 }
 
 static int compress_plug_pause(struct compress_plug_data *plug_data)
@@ -165,7 +321,7 @@ static int compress_plug_pause(struct compress_plug_data *plug_data)
 
 	rc = plugin->ops->pause(plugin);
 	if (!rc)
-		plugin->state = COMPRESS_PLUG_STATE_PAUSE;
+		compress_plug_set_state(plug_data, COMPRESS_PLUG_STATE_PAUSE);
 
 	return rc;
 }
@@ -180,7 +336,7 @@ static int compress_plug_resume(struct compress_plug_data *plug_data)
 
 	rc = plugin->ops->resume(plugin);
 	if (!rc)
-		plugin->state = COMPRESS_PLUG_STATE_RUNNING;
+		compress_plug_set_state(plug_data, COMPRESS_PLUG_STATE_RUNNING);
 
 	return rc;
 }
@@ -237,21 +393,7 @@ static int compress_plug_ioctl(void *data, unsigned int cmd, ...)
 	case SNDRV_COMPRESS_GET_CAPS:
 		ret = compress_plug_get_caps(plug_data, arg);
 		break;
-	case SNDRV_COMPRESS_SET_PARAMS:
-		ret = compress_plug_set_params(plug_data, arg);
-		break;
-	case SNDRV_COMPRESS_AVAIL:
-		ret = compress_plug_avail(plug_data, arg);
-		break;
-	case SNDRV_COMPRESS_TSTAMP:
-		ret = compress_plug_tstamp(plug_data, arg);
-		break;
-	case SNDRV_COMPRESS_START:
-		ret = compress_plug_start(plug_data);
-		break;
-	case SNDRV_COMPRESS_STOP:
-		ret = compress_plug_stop(plug_data);
-		break;
+	/* SET_PARAMS, AVAIL, TSTAMP, START and STOP have typed ops */
 	case SNDRV_COMPRESS_PAUSE:
 		ret = compress_plug_pause(plug_data);
 		break;
@@ -275,7 +417,7 @@ static int compress_plug_ioctl(void *data, unsigned int cmd, ...)
 		break;
 	}
 
-	return ret;
+	return compress_plug_errno(ret);
 }
 
 static int compress_plug_poll(void *data, struct pollfd *fds,
@@ -285,11 +427,56 @@ static int compress_plug_poll(void *data, struct pollfd *fds,
 	struct compress_plugin *plugin = plug_data->plugin;
 
 	if (plugin->state != COMPRESS_PLUG_STATE_RUNNING)
-		return -EBADFD;
+		return compress_plug_errno(-EBADFD);
 
-	return plugin->ops->poll(plugin, fds, nfds, timeout);
+	return compress_plug_errno(plugin->ops->poll(plugin, fds, nfds,
+				timeout));
 }
 
+static int compress_plug_get_poll_fd(void *data, short *events)
+{
+	struct compress_plug_data *plug_data = data;
+	struct compress_plugin *plugin = plug_data->plugin;
+
+	if (!compress_plug_has(plug_data, COMPRESS_PLUGIN_FEATURE_POLL_FD))
+		return -ENOSYS;
+
+	*events = POLLIN;
+	return plugin->ops->get_poll_fd(plugin);
+}
+
+static int compress_plug_handle_revents(void *data, short revents,
+		short *events)
+{
+	struct compress_plug_data *plug_data = data;
+	struct compress_plugin *plugin = plug_data->plugin;
+	uint64_t count;
+	ssize_t ret;
+	int fd;
+
+	*events = 0;
+	if (!compress_plug_has(plug_data, COMPRESS_PLUGIN_FEATURE_POLL_FD))
+		return -ENOSYS;
+	if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		*events = POLLERR;
+		return 0;
+	}
+	if (!(revents & POLLIN))
+		return 0;
+
+	/* clear the eventfd, it was readable so this does not block */
+	fd = plugin->ops->get_poll_fd(plugin);
+	if (fd < 0)
+		return -EBADFD;
+	ret = read(fd, &count, sizeof(count));
+	if (ret < 0)
+		return -errno;
+	if (ret != sizeof(count))
+		return -EIO;
+
+	*events = (plug_data->flags & COMPRESS_OUT) ? POLLIN : POLLOUT;
+	return 0;
+}
 
 static int compress_plug_read(void *data, void *buf, size_t size)
 {
@@ -298,9 +485,9 @@ static int compress_plug_read(void *data, void *buf, size_t size)
 
 	if (plugin->state != COMPRESS_PLUG_STATE_RUNNING &&
 		plugin->state != COMPRESS_PLUG_STATE_SETUP)
-		return -EBADFD;
+		return compress_plug_errno(-EBADFD);
 
-	return plugin->ops->read(plugin, buf, size);
+	return compress_plug_errno(plugin->ops->read(plugin, buf, size));
 }
 
 static int compress_plug_write(void *data, const void *buf, size_t size)
@@ -312,48 +499,150 @@ static int compress_plug_write(void *data, const void *buf, size_t size)
 	if (plugin->state != COMPRESS_PLUG_STATE_SETUP &&
 	    plugin->state != COMPRESS_PLUG_STATE_PREPARED &&
 	    plugin->state != COMPRESS_PLUG_STATE_RUNNING)
-		return -EBADFD;
+		return compress_plug_errno(-EBADFD);
 
 	rc = plugin->ops->write(plugin, buf, size);
 	if ((rc > 0) && (plugin->state == COMPRESS_PLUG_STATE_SETUP))
-		plugin->state = COMPRESS_PLUG_STATE_PREPARED;
+		compress_plug_set_state(plug_data, COMPRESS_PLUG_STATE_PREPARED);
 
-	return rc;
+	return compress_plug_errno(rc);
 }
 
-static void compress_plug_close(void *data)
+static int compress_plug_readv(void *data, const struct iovec *iov, int iovcnt)
 {
 	struct compress_plug_data *plug_data = data;
 	struct compress_plugin *plugin = plug_data->plugin;
+	int i, rc, total = 0;
 
-	plugin->ops->close(plugin);
-	dlclose(plug_data->dl_hdl);
+	if (plugin->state != COMPRESS_PLUG_STATE_RUNNING &&
+		plugin->state != COMPRESS_PLUG_STATE_SETUP)
+		return compress_plug_errno(-EBADFD);
+
+	if (compress_plug_has(plug_data, COMPRESS_PLUGIN_FEATURE_IOV))
+		return compress_plug_errno(plugin->ops->readv(plugin, iov,
+					iovcnt));
+
+	for (i = 0; i < iovcnt; i++) {
+		rc = plugin->ops->read(plugin, iov[i].iov_base, iov[i].iov_len);
+		if (rc < 0)
+			return total ? total : compress_plug_errno(rc);
+		total += rc;
+		if ((size_t)rc < iov[i].iov_len)
+			break;
+	}
 
-	free(plug_data);
+	return compress_plug_errno(total);
 }
 
-static int compress_plug_open(unsigned int card, unsigned int device,
-			unsigned int flags, void **data, void *node)
+static int compress_plug_writev(void *data, const struct iovec *iov, int iovcnt)
 {
-	struct compress_plug_data *plug_data;
-	void *dl_hdl;
-	int rc = 0;
-	char *so_name, *open_fn, token[80], *name, *token_saveptr;
+	struct compress_plug_data *plug_data = data;
+	struct compress_plugin *plugin = plug_data->plugin;
+	int i, rc, total = 0;
 
-	plug_data = calloc(1, sizeof(*plug_data));
-	if (!plug_data) {
-		return -ENOMEM;
+	if (plugin->state != COMPRESS_PLUG_STATE_SETUP &&
+	    plugin->state != COMPRESS_PLUG_STATE_PREPARED &&
+	    plugin->state != COMPRESS_PLUG_STATE_RUNNING)
+		return compress_plug_errno(-EBADFD);
+
+	if (compress_plug_has(plug_data, COMPRESS_PLUGIN_FEATURE_IOV)) {
+		total = plugin->ops->writev(plugin, iov, iovcnt);
+	} else {
+		for (i = 0; i < iovcnt; i++) {
+			rc = plugin->ops->write(plugin, iov[i].iov_base,
+						iov[i].iov_len);
+			if (rc < 0) {
+				if (!total)
+					total = rc;
+				break;
+			}
+			total += rc;
+			if ((size_t)rc < iov[i].iov_len)
+				break;
+		}
 	}
 
-	rc = snd_utils_get_str(node, "so-name", &so_name);
-	if (rc) {
-		fprintf(stderr, "%s: failed to get plugin lib name\n",
-				__func__);
-		goto err_get_lib;
+	if ((total > 0) && (plugin->state == COMPRESS_PLUG_STATE_SETUP))
+		compress_plug_set_state(plug_data, COMPRESS_PLUG_STATE_PREPARED);
+
+	return compress_plug_errno(total);
+}
+
+static int compress_plug_get_buffer(void *data, void **buf, size_t *size)
+{
+	struct compress_plug_data *plug_data = data;
+	struct compress_plugin *plugin = plug_data->plugin;
+
+	if (!compress_plug_has(plug_data, COMPRESS_PLUGIN_FEATURE_RING))
+		return -ENOSYS;
+
+	if (plugin->state != COMPRESS_PLUG_STATE_SETUP &&
+	    plugin->state != COMPRESS_PLUG_STATE_PREPARED &&
+	    plugin->state != COMPRESS_PLUG_STATE_RUNNING)
+		return -EBADFD;
+
+	return plugin->ops->get_buffer(plugin, buf, size);
+}
+
+static int compress_plug_commit(void *data, size_t size)
+{
+	struct compress_plug_data *plug_data = data;
+	struct compress_plugin *plugin = plug_data->plugin;
+	int rc;
+
+	if (!compress_plug_has(plug_data, COMPRESS_PLUGIN_FEATURE_RING))
+		return -ENOSYS;
+
+	if (plugin->state != COMPRESS_PLUG_STATE_SETUP &&
+	    plugin->state != COMPRESS_PLUG_STATE_PREPARED &&
+	    plugin->state != COMPRESS_PLUG_STATE_RUNNING)
+		return -EBADFD;
+
+	rc = plugin->ops->commit(plugin, size);
+	if (!rc && size && (plugin->state == COMPRESS_PLUG_STATE_SETUP))
+		compress_plug_set_state(plug_data, COMPRESS_PLUG_STATE_PREPARED);
+
+	return rc;
+}
+
+/* Called with plug_lib_lock held */
+static void compress_plug_lib_free(struct compress_plug_lib *lib)
+{
+	struct compress_plug_lib **link;
+
+	for (link = &plug_libs; *link != lib; link = &(*link)->next)
+		;
+	*link = lib->next;
+
+	dlclose(lib->dl_hdl);
+	free(lib->so_name);
+	free(lib);
+}
+
+static struct compress_plug_lib *compress_plug_lib_get(const char *so_name)
+{
+	struct compress_plug_lib *lib;
+	char *open_fn, token[80], *name, *token_saveptr;
+	char features_fn[96];
+
+	pthread_mutex_lock(&plug_lib_lock);
+
+	for (lib = plug_libs; lib; lib = lib->next) {
+		if (!strcmp(lib->so_name, so_name)) {
+			lib->refs++;
+			goto done;
+		}
 	}
 
-	dl_hdl = dlopen(so_name, RTLD_NOW);
-	if (!dl_hdl) {
+	lib = calloc(1, sizeof(*lib));
+	if (!lib)
+		goto done;
+	lib->so_name = strdup(so_name);
+	if (!lib->so_name)
+		goto err_so_name;
+
+	lib->dl_hdl = dlopen(so_name, RTLD_NOW);
+	if (!lib->dl_hdl) {
 		fprintf(stderr, "%s: unable to open %s, error: %s\n",
 					__func__, so_name, dlerror());
 		goto err_dl_open;
@@ -362,7 +651,7 @@ static int compress_plug_open(unsigned int card, unsigned int device,
 					__func__, so_name);
 	}
 
-	sscanf(so_name, "lib%s", token);
+	sscanf(so_name, "lib%79s", token);
 	token_saveptr = token;
 	name = strtok_r(token, ".", &token_saveptr);
 	if (!name) {
@@ -371,32 +660,168 @@ static int compress_plug_open(unsigned int card, unsigned int device,
 	}
 	const size_t open_fn_size = strlen(name) + strlen("_open") + 1;
 	open_fn = calloc(1, open_fn_size);
-	if (!open_fn) {
-		rc = -ENOMEM;
+	if (!open_fn)
 		goto err_open_fn;
-	}
 
 	strlcpy(open_fn, name, open_fn_size);
 	strlcat(open_fn, "_open", open_fn_size);
 
-	plug_data->plugin_open_fn = dlsym(dl_hdl, open_fn);
-	if (!plug_data->plugin_open_fn) {
+	lib->plugin_open_fn = dlsym(lib->dl_hdl, open_fn);
+	free(open_fn);
+	if (!lib->plugin_open_fn) {
 		fprintf(stderr, "%s: dlsym to open fn failed, err = '%s'\n",
 				__func__, dlerror());
-		goto err_dlsym;
+		goto err_open_fn;
 	}
 
-	rc = plug_data->plugin_open_fn(&plug_data->plugin,
+	/* optional, absent in version 1 plugins */
+	snprintf(features_fn, sizeof(features_fn), "%s_get_features", name);
+	lib->features = compress_plug_negotiate(dlsym(lib->dl_hdl,
+				features_fn));
+
+	lib->refs = 1;
+	lib->next = plug_libs;
+	plug_libs = lib;
+	goto done;
+
+err_open_fn:
+	dlclose(lib->dl_hdl);
+err_dl_open:
+	free(lib->so_name);
+err_so_name:
+	free(lib);
+	lib = NULL;
+done:
+	pthread_mutex_unlock(&plug_lib_lock);
+	return lib;
+}
+
+static void compress_plug_lib_put(struct compress_plug_lib *lib)
+{
+	pthread_mutex_lock(&plug_lib_lock);
+	if ((--lib->refs == 0) && lib->dl_hdl &&
+	    (plug_lib_policy == COMPRESS_PLUGIN_UNLOAD_ON_CLOSE))
+		compress_plug_lib_free(lib);
+	pthread_mutex_unlock(&plug_lib_lock);
+}
+
+int compress_plugin_register(const char *so_name,
+		int (*open_fn) (struct compress_plugin **plugin,
+				unsigned int card,
+				unsigned int device,
+				unsigned int flags))
+{
+	return compress_plugin_register_v2(so_name, open_fn, NULL);
+}
+
+int compress_plugin_register_v2(const char *so_name,
+		int (*open_fn) (struct compress_plugin **plugin,
+				unsigned int card,
+				unsigned int device,
+				unsigned int flags),
+		unsigned int (*get_features_fn) (unsigned int version))
+{
+	struct compress_plug_lib *lib;
+	int rc = 0;
+
+	pthread_mutex_lock(&plug_lib_lock);
+
+	for (lib = plug_libs; lib; lib = lib->next) {
+		if (!strcmp(lib->so_name, so_name)) {
+			rc = -EEXIST;
+			goto done;
+		}
+	}
+
+	lib = calloc(1, sizeof(*lib));
+	if (!lib) {
+		rc = -ENOMEM;
+		goto done;
+	}
+	lib->so_name = strdup(so_name);
+	if (!lib->so_name) {
+		free(lib);
+		rc = -ENOMEM;
+		goto done;
+	}
+	lib->plugin_open_fn = open_fn;
+	lib->features = compress_plug_negotiate(get_features_fn);
+	lib->next = plug_libs;
+	plug_libs = lib;
+
+done:
+	pthread_mutex_unlock(&plug_lib_lock);
+	return rc;
+}
+
+void compress_set_plugin_policy(enum compress_plugin_policy policy)
+{
+	struct compress_plug_lib *lib, *next;
+
+	pthread_mutex_lock(&plug_lib_lock);
+	plug_lib_policy = policy;
+	if (policy == COMPRESS_PLUGIN_UNLOAD_ON_CLOSE) {
+		/* drop what the previous policy kept resident */
+		for (lib = plug_libs; lib; lib = next) {
+			next = lib->next;
+			if (!lib->refs && lib->dl_hdl)
+				compress_plug_lib_free(lib);
+		}
+	}
+	pthread_mutex_unlock(&plug_lib_lock);
+}
+
+static void compress_plug_close(void *data)
+{
+	struct compress_plug_data *plug_data = data;
+	struct compress_plugin *plugin = plug_data->plugin;
+
+	plugin->ops->close(plugin);
+	compress_plug_lib_put(plug_data->lib);
+
+	free(plug_data);
+}
+
+static int compress_plug_open(unsigned int card, unsigned int device,
+			unsigned int flags, void **data, void *node)
+{
+	struct compress_plug_data *plug_data;
+	int rc = 0;
+	char *so_name;
+
+	plug_data = calloc(1, sizeof(*plug_data));
+	if (!plug_data) {
+		return -ENOMEM;
+	}
+	compress_trace_set_id(plug_data->trace_id, card, device);
+
+	rc = snd_utils_get_str(node, "so-name", &so_name);
+	if (rc) {
+		fprintf(stderr, "%s: failed to get plugin lib name\n",
+				__func__);
+		rc = -EINVAL;
+		goto err_get_lib;
+	}
+
+	plug_data->lib = compress_plug_lib_get(so_name);
+	if (!plug_data->lib) {
+		rc = -ENODEV;
+		goto err_get_lib;
+	}
+	plug_data->features = plug_data->lib->features;
+
+	rc = plug_data->lib->plugin_open_fn(&plug_data->plugin,
 					card, device, flags);
 	if (rc) {
 		fprintf(stderr, "%s: failed to open plugin\n", __func__);
-		goto err_dlsym;
+		goto err_open;
 	}
 
+	compress_plug_check_features(plug_data);
+
 	/* Call snd-card-def to get card and compress nodes */
 	/* Check how to manage fd for plugin */
 
-	plug_data->dl_hdl = dl_hdl;
 	plug_data->card = card;
 	plug_data->device = device;
 	plug_data->dev_node = node;
@@ -404,26 +829,36 @@ static int compress_plug_open(unsigned int card, unsigned int device,
 
 	*data = plug_data;
 
-	plug_data->plugin->state = COMPRESS_PLUG_STATE_OPEN;
+	compress_plug_set_state(plug_data, COMPRESS_PLUG_STATE_OPEN);
 
 	return 0;
 
-err_dlsym:
-	free(open_fn);
-err_open_fn:
-	dlclose(dl_hdl);
+err_open:
+	compress_plug_lib_put(plug_data->lib);
 err_get_lib:
-err_dl_open:
 	free(plug_data);
 
 	return rc;
 }
 
-struct compress_ops compr_plug_ops = {
+const struct compress_ops compr_plug_ops = {
 	.open = compress_plug_open,
 	.close = compress_plug_close,
 	.ioctl = compress_plug_ioctl,
 	.read = compress_plug_read,
 	.write = compress_plug_write,
+	.readv = compress_plug_readv,
+	.writev = compress_plug_writev,
 	.poll = compress_plug_poll,
+	.get_buffer = compress_plug_get_buffer,
+	.commit = compress_plug_commit,
+	.get_poll_fd = compress_plug_get_poll_fd,
+	.handle_revents = compress_plug_handle_revents,
+	.avail = compress_plug_avail,
+	.tstamp = compress_plug_tstamp,
+	.start = compress_plug_start,
+	.stop = compress_plug_stop,
+	.set_params = compress_plug_set_params,
+	.tstamp64 = compress_plug_tstamp64,
+	.set_metadata = compress_plug_set_metadata,
 };
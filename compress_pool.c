@@ -0,0 +1,224 @@
+/* compress_pool.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <linux/types.h>
+#define __force
+#define __bitwise
+#define __user
+#include "sound/compress_params.h"
+#include "tinycompress/tinycompress.h"
+#include "compress_pool.h"
+
+struct compress_pool {
+	unsigned int card;
+	unsigned int device;
+	unsigned int flags;
+	struct compr_config config;
+	struct snd_codec codec;
+
+	/* stack of configured streams, acquire and release are O(1) */
+	pthread_mutex_t lock;
+	unsigned int size;
+	unsigned int idle;
+	struct compress **streams;
+
+	atomic_ullong hits;
+	atomic_ullong misses;
+	atomic_ullong recycled;
+	atomic_ullong reopened;
+	atomic_ullong acquire_ns;
+	atomic_ullong acquire_max_ns;
+};
+
+static struct compress *compress_pool_open_stream(struct compress_pool *pool)
+{
+	struct compr_config config = pool->config;
+
+	return compress_open(pool->card, pool->device, pool->flags, &config);
+}
+
+struct compress_pool *compress_pool_create(unsigned int card,
+		unsigned int device, unsigned int flags,
+		const struct compr_config *config, unsigned int size)
+{
+	struct compress_pool *pool;
+	struct compress *compress;
+
+	if (!config || !config->codec || !size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	pool->streams = calloc(size, sizeof(*pool->streams));
+	if (!pool->streams) {
+		free(pool);
+		return NULL;
+	}
+
+	pool->card = card;
+	pool->device = device;
+	pool->flags = flags;
+	pool->codec = *config->codec;
+	pool->config = *config;
+	pool->config.codec = &pool->codec;
+	pool->size = size;
+	pthread_mutex_init(&pool->lock, NULL);
+
+	/* devices may allow fewer streams than asked for, keep what we get */
+	while (pool->idle < size) {
+		compress = compress_pool_open_stream(pool);
+		if (!is_compress_ready(compress))
+			break;
+		pool->streams[pool->idle++] = compress;
+	}
+	if (!pool->idle) {
+		compress_pool_destroy(pool);
+		errno = ENODEV;
+		return NULL;
+	}
+
+	return pool;
+}
+
+void compress_pool_destroy(struct compress_pool *pool)
+{
+	if (!pool)
+		return;
+
+	while (pool->idle)
+		compress_close(pool->streams[--pool->idle]);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->streams);
+	free(pool);
+}
+
+struct compress *compress_pool_acquire(struct compress_pool *pool)
+{
+	struct compress *compress = NULL;
+	struct timespec start, end;
+	unsigned long long ns, max;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->idle)
+		compress = pool->streams[--pool->idle];
+	pthread_mutex_unlock(&pool->lock);
+
+	if (compress) {
+		atomic_fetch_add_explicit(&pool->hits, 1, memory_order_relaxed);
+	} else {
+		atomic_fetch_add_explicit(&pool->misses, 1, memory_order_relaxed);
+		compress = compress_pool_open_stream(pool);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start.tv_sec) * 1000000000ULL +
+		end.tv_nsec - start.tv_nsec;
+	atomic_fetch_add_explicit(&pool->acquire_ns, ns, memory_order_relaxed);
+	max = atomic_load_explicit(&pool->acquire_max_ns, memory_order_relaxed);
+	while ((ns > max) &&
+	       !atomic_compare_exchange_weak_explicit(&pool->acquire_max_ns,
+			&max, ns, memory_order_relaxed, memory_order_relaxed))
+		;
+
+	return compress;
+}
+
+void compress_pool_release(struct compress_pool *pool,
+		struct compress *compress)
+{
+	bool room;
+
+	if (!is_compress_ready(compress))
+		return;
+
+	if (!compress_pool_reset_stream(compress)) {
+		atomic_fetch_add_explicit(&pool->recycled, 1,
+				memory_order_relaxed);
+	} else {
+		compress_close(compress);
+
+		pthread_mutex_lock(&pool->lock);
+		room = pool->idle < pool->size;
+		pthread_mutex_unlock(&pool->lock);
+		if (!room)
+			return;
+
+		/* reopen now rather than on the next acquire */
+		compress = compress_pool_open_stream(pool);
+		if (!is_compress_ready(compress))
+			return;
+		atomic_fetch_add_explicit(&pool->reopened, 1,
+				memory_order_relaxed);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->idle < pool->size) {
+		pool->streams[pool->idle++] = compress;
+		compress = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (compress)
+		compress_close(compress);
+}
+
+void compress_pool_get_stats(struct compress_pool *pool,
+		struct compress_pool_stats *stats)
+{
+	pthread_mutex_lock(&pool->lock);
+	stats->size = pool->size;
+	stats->idle = pool->idle;
+	pthread_mutex_unlock(&pool->lock);
+
+	stats->hits = atomic_load_explicit(&pool->hits, memory_order_relaxed);
+	stats->misses = atomic_load_explicit(&pool->misses,
+			memory_order_relaxed);
+	stats->recycled = atomic_load_explicit(&pool->recycled,
+			memory_order_relaxed);
+	stats->reopened = atomic_load_explicit(&pool->reopened,
+			memory_order_relaxed);
+	stats->acquire_ns = atomic_load_explicit(&pool->acquire_ns,
+			memory_order_relaxed);
+	stats->acquire_max_ns = atomic_load_explicit(&pool->acquire_max_ns,
+			memory_order_relaxed);
+}
@@ -0,0 +1,236 @@
+/* compress_replay.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "compress_replay.h"
+
+#define NSEC_PER_USEC	1000ULL
+
+struct compress_replay_sample {
+	uint64_t ns;
+	uint64_t bytes;
+	uint64_t frames;
+};
+
+struct compress_replay {
+	unsigned int num_samples;
+	struct compress_replay_sample *samples;
+
+	/* the last sample, where the trace starts over */
+	uint64_t period_ns;
+	uint64_t period_bytes;
+	uint64_t period_frames;
+};
+
+static int compress_replay_add(struct compress_replay *replay,
+		unsigned int *size, const struct compress_replay_sample *sample)
+{
+	struct compress_replay_sample *samples;
+
+	if (replay->num_samples == *size) {
+		*size = *size ? *size * 2 : 256;
+		samples = realloc(replay->samples, *size * sizeof(*samples));
+		if (!samples)
+			return -ENOMEM;
+		replay->samples = samples;
+	}
+	replay->samples[replay->num_samples++] = *sample;
+	return 0;
+}
+
+struct compress_replay *compress_replay_load(const char *path)
+{
+	struct compress_replay_sample sample, first = { 0 }, *last = NULL;
+	struct compress_replay *replay;
+	unsigned long long usec, bytes, frames;
+	unsigned int size = 0;
+	char line[256];
+	FILE *file;
+	int ret = 0;
+
+	replay = calloc(1, sizeof(*replay));
+	if (!replay)
+		return NULL;
+
+	file = fopen(path, "r");
+	if (!file) {
+		ret = -errno;
+		goto err_open;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "#")] = '\0';
+		if (line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+		if (sscanf(line, "%llu %llu %llu", &usec, &bytes, &frames) != 3) {
+			ret = -EINVAL;
+			goto err_parse;
+		}
+
+		sample.ns = usec * NSEC_PER_USEC;
+		sample.bytes = bytes;
+		sample.frames = frames;
+		if (!replay->num_samples) {
+			first = sample;
+		} else if ((sample.ns < first.ns + last->ns) ||
+			   (sample.bytes < first.bytes + last->bytes) ||
+			   (sample.frames < first.frames + last->frames)) {
+			ret = -EINVAL;
+			goto err_parse;
+		}
+
+		sample.ns -= first.ns;
+		sample.bytes -= first.bytes;
+		sample.frames -= first.frames;
+		ret = compress_replay_add(replay, &size, &sample);
+		if (ret)
+			goto err_parse;
+		last = &replay->samples[replay->num_samples - 1];
+	}
+
+	/* a trace moving no data, or none in no time, can't be repeated */
+	if (!replay->num_samples || !last->ns || !last->bytes) {
+		ret = -EINVAL;
+		goto err_parse;
+	}
+	replay->period_ns = last->ns;
+	replay->period_bytes = last->bytes;
+	replay->period_frames = last->frames;
+
+	fclose(file);
+	return replay;
+
+err_parse:
+	fclose(file);
+err_open:
+	compress_replay_free(replay);
+	errno = -ret;
+	return NULL;
+}
+
+void compress_replay_free(struct compress_replay *replay)
+{
+	if (!replay)
+		return;
+
+	free(replay->samples);
+	free(replay);
+}
+
+/* Last sample at or before ns into a period */
+static unsigned int compress_replay_find_ns(const struct compress_replay *replay,
+		uint64_t ns)
+{
+	unsigned int lo = 0, hi = replay->num_samples - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (replay->samples[mid].ns <= ns)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/* Last sample with at most bytes into a period */
+static unsigned int compress_replay_find_last(
+		const struct compress_replay *replay, uint64_t bytes)
+{
+	unsigned int lo = 0, hi = replay->num_samples - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (replay->samples[mid].bytes <= bytes)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/* First sample with at least bytes into a period */
+static unsigned int compress_replay_find_first(
+		const struct compress_replay *replay, uint64_t bytes)
+{
+	unsigned int lo = 0, hi = replay->num_samples - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (replay->samples[mid].bytes >= bytes)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+void compress_replay_position(const struct compress_replay *replay,
+		uint64_t ns, uint64_t limit, uint64_t *bytes, uint64_t *frames)
+{
+	const struct compress_replay_sample *sample;
+	uint64_t period;
+
+	period = ns / replay->period_ns;
+	sample = &replay->samples[compress_replay_find_ns(replay,
+			ns % replay->period_ns)];
+	*bytes = period * replay->period_bytes + sample->bytes;
+	*frames = period * replay->period_frames + sample->frames;
+	if (*bytes <= limit)
+		return;
+
+	/* starved, played up to the last sample it had the data for */
+	period = limit / replay->period_bytes;
+	sample = &replay->samples[compress_replay_find_last(replay,
+			limit % replay->period_bytes)];
+	*bytes = limit;
+	*frames = period * replay->period_frames + sample->frames;
+}
+
+uint64_t compress_replay_time_of(const struct compress_replay *replay,
+		uint64_t bytes)
+{
+	const struct compress_replay_sample *sample;
+	uint64_t period;
+
+	if (!bytes)
+		return 0;
+
+	/* the end of a period is reached in it, not at the next one */
+	period = (bytes - 1) / replay->period_bytes;
+	sample = &replay->samples[compress_replay_find_first(replay,
+			bytes - period * replay->period_bytes)];
+	return period * replay->period_ns + sample->ns;
+}
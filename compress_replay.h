@@ -0,0 +1,67 @@
+/* compress_replay.h
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#ifndef __COMPRESS_REPLAY_H__
+#define __COMPRESS_REPLAY_H__
+
+#include <stdint.h>
+
+/*
+ * DSP consumption recorded on a real device, replayed by the loopback
+ * plugin instead of a constant bit rate. A trace is a text file with one
+ * sample per line, '#' starts a comment:
+ *
+ *	<usec> <copied_total> <pcm_io_frames>
+ *
+ * i.e. the time and the snd_compr_tstamp counters read whenever AVAIL
+ * changed. Times and counters must not decrease, they are taken relative
+ * to the first sample. The DSP is taken to move the bytes of a sample in
+ * one burst at its time, and the trace repeats once it ends.
+ */
+struct compress_replay;
+
+/* Returns NULL with errno set if the trace can't be read or is invalid */
+struct compress_replay *compress_replay_load(const char *path);
+
+void compress_replay_free(struct compress_replay *replay);
+
+/*
+ * Position of the DSP after ns of running time, when no more than limit
+ * bytes were available to it: stalls on missing data don't delay the
+ * rest of the trace.
+ */
+void compress_replay_position(const struct compress_replay *replay,
+		uint64_t ns, uint64_t limit, uint64_t *bytes, uint64_t *frames);
+
+/* Running time at which the DSP has consumed bytes */
+uint64_t compress_replay_time_of(const struct compress_replay *replay,
+		uint64_t bytes);
+
+#endif /* __COMPRESS_REPLAY_H__ */
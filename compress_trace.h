@@ -0,0 +1,99 @@
+/* compress_trace.h
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#ifndef __COMPRESS_TRACE_H__
+#define __COMPRESS_TRACE_H__
+
+/*
+ * Trace events for correlating stream activity with kernel traces. They
+ * go to the ftrace marker through atrace under the audio tag and are only
+ * built with -DCOMPRESS_TRACE, otherwise the hooks compile to nothing and
+ * their arguments are not evaluated.
+ */
+#ifdef COMPRESS_TRACE
+
+#include <errno.h>
+#include <stdio.h>
+#include <cutils/trace.h>
+
+/* Stream identity attached to every event, "C<card>D<device>" */
+#define COMPRESS_TRACE_ID_MAX	16
+#define COMPRESS_TRACE_NAME_MAX	64
+
+static inline void compress_trace_set_id(char *id, unsigned int card,
+		unsigned int device)
+{
+	snprintf(id, COMPRESS_TRACE_ID_MAX, "C%uD%u", card, device);
+}
+
+/* The hooks sit around system calls, so they must leave errno alone */
+static inline void compress_trace_begin(const char *id, const char *event)
+{
+	char name[COMPRESS_TRACE_NAME_MAX];
+	int err = errno;
+
+	if (!atrace_is_tag_enabled(ATRACE_TAG_AUDIO))
+		return;
+	snprintf(name, sizeof(name), "%s %s", event, id);
+	atrace_begin(ATRACE_TAG_AUDIO, name);
+	errno = err;
+}
+
+static inline void compress_trace_end(void)
+{
+	int err = errno;
+
+	atrace_end(ATRACE_TAG_AUDIO);
+	errno = err;
+}
+
+static inline void compress_trace_int(const char *id, const char *event,
+		int value)
+{
+	char name[COMPRESS_TRACE_NAME_MAX];
+	int err = errno;
+
+	if (!atrace_is_tag_enabled(ATRACE_TAG_AUDIO))
+		return;
+	snprintf(name, sizeof(name), "%s %s", event, id);
+	atrace_int(ATRACE_TAG_AUDIO, name, value);
+	errno = err;
+}
+
+#else
+
+#define compress_trace_set_id(id, card, device)	do { } while (0)
+#define compress_trace_begin(id, event)		do { } while (0)
+#define compress_trace_end()			do { } while (0)
+#define compress_trace_int(id, event, value)	do { } while (0)
+
+#endif /* COMPRESS_TRACE */
+
+#endif /* __COMPRESS_TRACE_H__ */
@@ -0,0 +1,660 @@
+/* compress_uring.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <sound/asound.h>
+#include "tinycompress/tinycompress.h"
+#include "compress_ops.h"
+
+/*
+ * io_uring backend for compress devices: reads, writes and polls of all
+ * streams go through one process wide ring. There is no completion
+ * thread. One waiting thread at a time sits in io_uring_enter, submitting
+ * everything queued since its last call and collecting the completions
+ * of all streams, so a single stream costs one io_uring_enter per request.
+ * Requests queued while that thread is blocked are submitted by their own
+ * thread, which then sleeps until the waiter hands its completion over.
+ *
+ * SNDRV_COMPRESS_AVAIL and the control ioctls have no io_uring
+ * equivalent, the compress core implements no uring_cmd, and are
+ * forwarded to the hw backend, which also owns the device fd.
+ */
+
+#define URING_ENTRIES	64
+
+extern const struct compress_ops compr_hw_ops;
+
+struct compress_uring {
+	int fd;
+	unsigned int entries;
+	unsigned int inflight;
+	/* queued in the sq ring but not passed to io_uring_enter yet */
+	unsigned int unsubmitted;
+	/* a thread is in io_uring_enter collecting completions */
+	bool waiting;
+	/* set once the ring failed, every request then fails with it */
+	int error;
+	struct compress_uring_req *reqs;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	pthread_mutex_t lock;
+	/* signalled when requests complete and when the waiter leaves */
+	pthread_cond_t cond;
+	int refs;
+};
+
+/* A request waiting for its completion, on the stack of its submitter */
+struct compress_uring_req {
+	struct compress_uring_req *next;
+	struct compress_uring_req **pprev;
+	int done;
+	int res;
+};
+
+struct compress_uring_data {
+	void *hw_data;
+	int fd;
+	struct compress_uring *uring;
+};
+
+static struct compress_uring *compr_uring;
+static pthread_mutex_t compr_uring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit,
+		unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg,
+		unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_complete(struct compress_uring_req *req, int res)
+{
+	req->res = res;
+	req->done = 1;
+	*req->pprev = req->next;
+	if (req->next)
+		req->next->pprev = req->pprev;
+}
+
+/* The ring is unusable, fail everything in flight. Called with the lock */
+static void uring_fail(struct compress_uring *uring, int error)
+{
+	fprintf(stderr, "%s: io_uring_enter failed: %s\n", __func__,
+			strerror(-error));
+	uring->error = error;
+	while (uring->reqs)
+		uring_complete(uring->reqs, error);
+	pthread_cond_broadcast(&uring->cond);
+}
+
+/* Collect the completions posted so far. Called with the lock */
+static void uring_reap(struct compress_uring *uring)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail, reaped;
+
+	head = *uring->cq_head;
+	tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	for (reaped = 0; head != tail; head++, reaped++) {
+		cqe = &uring->cqes[head & *uring->cq_mask];
+		/* the linked timeouts carry no request */
+		if (cqe->user_data)
+			uring_complete((void *)(uintptr_t)cqe->user_data,
+					cqe->res);
+	}
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+	if (reaped) {
+		uring->inflight -= reaped;
+		pthread_cond_broadcast(&uring->cond);
+	}
+}
+
+/*
+ * Pass the queued sqes to the kernel and, with wait, block until at least
+ * one completion is posted. Drops the lock for the syscall.
+ */
+static void uring_enter_locked(struct compress_uring *uring, bool wait)
+{
+	unsigned int nr = uring->unsubmitted;
+	int ret, err;
+
+	uring->unsubmitted = 0;
+	pthread_mutex_unlock(&uring->lock);
+	ret = uring_enter(uring->fd, nr, wait ? 1 : 0,
+			wait ? IORING_ENTER_GETEVENTS : 0);
+	err = errno;
+	pthread_mutex_lock(&uring->lock);
+
+	/* whatever the kernel did not take is submitted by the next call */
+	if (ret < 0) {
+		uring->unsubmitted += nr;
+		if ((err != EINTR) && (err != EAGAIN) && (err != EBUSY))
+			uring_fail(uring, -err);
+	} else if ((unsigned int)ret < nr) {
+		uring->unsubmitted += nr - ret;
+	}
+}
+
+/* Become the waiting thread until a completion arrives. Called with the lock */
+static void uring_collect(struct compress_uring *uring)
+{
+	uring->waiting = true;
+	uring_enter_locked(uring, true);
+	uring->waiting = false;
+	uring_reap(uring);
+	/* hand the ring over to the threads still waiting */
+	pthread_cond_broadcast(&uring->cond);
+}
+
+static int uring_probe(int fd)
+{
+	static const int needed[] = {
+		IORING_OP_NOP, IORING_OP_POLL_ADD, IORING_OP_LINK_TIMEOUT,
+		IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV,
+		IORING_OP_WRITEV,
+	};
+	struct io_uring_probe *probe;
+	size_t len;
+	unsigned int i;
+	int ret = 0;
+
+	len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	probe = calloc(1, len);
+	if (!probe)
+		return -ENOMEM;
+
+	if (uring_register(fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		ret = -errno;
+		goto done;
+	}
+
+	for (i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+		if ((needed[i] > probe->last_op) ||
+		    !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+			ret = -ENOSYS;
+			break;
+		}
+	}
+done:
+	free(probe);
+	return ret;
+}
+
+static void uring_unmap(struct compress_uring *uring)
+{
+	if (uring->sqes)
+		munmap(uring->sqes, uring->sqes_size);
+	if (uring->cq_ring && (uring->cq_ring != uring->sq_ring))
+		munmap(uring->cq_ring, uring->cq_ring_size);
+	if (uring->sq_ring)
+		munmap(uring->sq_ring, uring->sq_ring_size);
+}
+
+static int uring_map(struct compress_uring *uring, struct io_uring_params *p)
+{
+	uring->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+	uring->cq_ring_size = p->cq_off.cqes +
+		p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (uring->cq_ring_size > uring->sq_ring_size)
+			uring->sq_ring_size = uring->cq_ring_size;
+		uring->cq_ring_size = uring->sq_ring_size;
+	}
+
+	uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	if (uring->sq_ring == MAP_FAILED) {
+		uring->sq_ring = NULL;
+		return -errno;
+	}
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		uring->cq_ring = uring->sq_ring;
+	} else {
+		uring->cq_ring = mmap(NULL, uring->cq_ring_size,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				uring->fd, IORING_OFF_CQ_RING);
+		if (uring->cq_ring == MAP_FAILED) {
+			uring->cq_ring = NULL;
+			return -errno;
+		}
+	}
+
+	uring->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		uring->sqes = NULL;
+		return -errno;
+	}
+
+	uring->sq_head = (void *)((char *)uring->sq_ring + p->sq_off.head);
+	uring->sq_tail = (void *)((char *)uring->sq_ring + p->sq_off.tail);
+	uring->sq_mask = (void *)((char *)uring->sq_ring + p->sq_off.ring_mask);
+	uring->sq_array = (void *)((char *)uring->sq_ring + p->sq_off.array);
+	uring->cq_head = (void *)((char *)uring->cq_ring + p->cq_off.head);
+	uring->cq_tail = (void *)((char *)uring->cq_ring + p->cq_off.tail);
+	uring->cq_mask = (void *)((char *)uring->cq_ring + p->cq_off.ring_mask);
+	uring->cqes = (void *)((char *)uring->cq_ring + p->cq_off.cqes);
+
+	return 0;
+}
+
+static struct compress_uring *uring_create(void)
+{
+	struct compress_uring *uring;
+	struct io_uring_params p;
+	int ret;
+
+	uring = calloc(1, sizeof(*uring));
+	if (!uring)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	uring->fd = uring_setup(URING_ENTRIES, &p);
+	if (uring->fd < 0)
+		goto err_setup;
+
+	ret = uring_probe(uring->fd);
+	if (!ret)
+		ret = uring_map(uring, &p);
+	if (ret) {
+		errno = -ret;
+		goto err_map;
+	}
+
+	/* a poll with timeout takes two entries, keep the cq from overflowing */
+	uring->entries = p.sq_entries < p.cq_entries ? p.sq_entries : p.cq_entries;
+	pthread_mutex_init(&uring->lock, NULL);
+	pthread_cond_init(&uring->cond, NULL);
+
+	return uring;
+
+err_map:
+	uring_unmap(uring);
+	close(uring->fd);
+err_setup:
+	free(uring);
+	return NULL;
+}
+
+static void uring_destroy(struct compress_uring *uring)
+{
+	pthread_cond_destroy(&uring->cond);
+	pthread_mutex_destroy(&uring->lock);
+	uring_unmap(uring);
+	close(uring->fd);
+	free(uring);
+}
+
+static struct compress_uring *uring_get(void)
+{
+	struct compress_uring *uring;
+
+	pthread_mutex_lock(&compr_uring_lock);
+	/* a failed ring stays with its streams, new ones get a fresh one */
+	if (compr_uring) {
+		pthread_mutex_lock(&compr_uring->lock);
+		if (compr_uring->error)
+			compr_uring = NULL;
+		pthread_mutex_unlock(&compr_uring->lock);
+	}
+	if (!compr_uring)
+		compr_uring = uring_create();
+	uring = compr_uring;
+	if (uring)
+		uring->refs++;
+	pthread_mutex_unlock(&compr_uring_lock);
+
+	return uring;
+}
+
+static void uring_put(struct compress_uring *uring)
+{
+	pthread_mutex_lock(&compr_uring_lock);
+	if (--uring->refs == 0) {
+		if (compr_uring == uring)
+			compr_uring = NULL;
+		uring_destroy(uring);
+	}
+	pthread_mutex_unlock(&compr_uring_lock);
+}
+
+/*
+ * Queue the sqes and wait for the completion of the first one. The first
+ * thread to wait submits what all streams queued and collects every
+ * completion, the others only submit what is left and sleep until it
+ * completes their request or leaves the ring to them. Requests finish on
+ * their own or by their linked timeout; a failing ring fails them all.
+ */
+static int uring_run(struct compress_uring *uring,
+		struct io_uring_sqe *sqes, unsigned int nr)
+{
+	struct compress_uring_req req = { NULL, NULL, 0, 0 };
+	unsigned int tail, idx, i;
+	int ret;
+
+	pthread_mutex_lock(&uring->lock);
+	while (!uring->error && (uring->inflight + nr > uring->entries)) {
+		if (uring->waiting)
+			pthread_cond_wait(&uring->cond, &uring->lock);
+		else
+			uring_collect(uring);
+	}
+	if (uring->error) {
+		ret = uring->error;
+		pthread_mutex_unlock(&uring->lock);
+		return ret;
+	}
+
+	sqes[0].user_data = (uintptr_t)&req;
+	tail = *uring->sq_tail;
+	for (i = 0; i < nr; i++) {
+		idx = (tail + i) & *uring->sq_mask;
+		uring->sqes[idx] = sqes[i];
+		uring->sq_array[idx] = idx;
+	}
+	__atomic_store_n(uring->sq_tail, tail + nr, __ATOMIC_RELEASE);
+	uring->inflight += nr;
+	uring->unsubmitted += nr;
+
+	req.next = uring->reqs;
+	req.pprev = &uring->reqs;
+	if (req.next)
+		req.next->pprev = &req.next;
+	uring->reqs = &req;
+
+	while (!req.done) {
+		if (!uring->waiting)
+			uring_collect(uring);
+		else if (uring->unsubmitted)
+			uring_enter_locked(uring, false);
+		else
+			pthread_cond_wait(&uring->cond, &uring->lock);
+	}
+	pthread_mutex_unlock(&uring->lock);
+
+	return req.res;
+}
+
+static int uring_rw(struct compress_uring_data *uring_data, int opcode,
+		const void *addr, unsigned int len)
+{
+	struct io_uring_sqe sqe;
+	int ret;
+
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = opcode;
+	sqe.fd = uring_data->fd;
+	sqe.addr = (uintptr_t)addr;
+	sqe.len = len;
+	sqe.off = (__u64)-1;
+
+	ret = uring_run(uring_data->uring, &sqe, 1);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+static int compress_uring_poll(void *data, struct pollfd *fds,
+		nfds_t nfds, int timeout)
+{
+	struct compress_uring_data *uring_data = data;
+	struct io_uring_sqe sqes[2];
+	struct __kernel_timespec ts;
+	unsigned int nr = 1;
+	int ret;
+
+	if (nfds != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fds->fd = uring_data->fd;
+	fds->revents = 0;
+
+	memset(sqes, 0, sizeof(sqes));
+	sqes[0].opcode = IORING_OP_POLL_ADD;
+	sqes[0].fd = uring_data->fd;
+	sqes[0].poll_events = fds->events;
+
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000LL;
+		sqes[0].flags = IOSQE_IO_LINK;
+		sqes[1].opcode = IORING_OP_LINK_TIMEOUT;
+		sqes[1].fd = -1;
+		sqes[1].addr = (uintptr_t)&ts;
+		sqes[1].len = 1;
+		nr = 2;
+	}
+
+	ret = uring_run(uring_data->uring, sqes, nr);
+	/* the linked timeout fired */
+	if (ret == -ECANCELED)
+		return 0;
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	fds->revents = ret;
+	return 1;
+}
+
+static int compress_uring_write(void *data, const void *buf, size_t size)
+{
+	if (size > UINT_MAX)
+		size = UINT_MAX;
+	return uring_rw(data, IORING_OP_WRITE, buf, size);
+}
+
+static int compress_uring_read(void *data, void *buf, size_t size)
+{
+	if (size > UINT_MAX)
+		size = UINT_MAX;
+	return uring_rw(data, IORING_OP_READ, buf, size);
+}
+
+static int compress_uring_writev(void *data, const struct iovec *iov,
+		int iovcnt)
+{
+	return uring_rw(data, IORING_OP_WRITEV, iov, iovcnt);
+}
+
+static int compress_uring_readv(void *data, const struct iovec *iov,
+		int iovcnt)
+{
+	return uring_rw(data, IORING_OP_READV, iov, iovcnt);
+}
+
+static int compress_uring_avail(void *data, struct snd_compr_avail *avail)
+{
+	struct compress_uring_data *uring_data = data;
+
+	return compr_hw_ops.avail(uring_data->hw_data, avail);
+}
+
+static int compress_uring_tstamp(void *data, struct snd_compr_tstamp *tstamp)
+{
+	struct compress_uring_data *uring_data = data;
+
+	return compr_hw_ops.tstamp(uring_data->hw_data, tstamp);
+}
+
+static int compress_uring_start(void *data)
+{
+	struct compress_uring_data *uring_data = data;
+
+	return compr_hw_ops.start(uring_data->hw_data);
+}
+
+static int compress_uring_stop(void *data)
+{
+	struct compress_uring_data *uring_data = data;
+
+	return compr_hw_ops.stop(uring_data->hw_data);
+}
+
+static int compress_uring_set_params(void *data,
+		struct snd_compr_params *params)
+{
+	struct compress_uring_data *uring_data = data;
+
+	return compr_hw_ops.set_params(uring_data->hw_data, params);
+}
+
+static int compress_uring_ioctl(void *data, unsigned int cmd, ...)
+{
+	struct compress_uring_data *uring_data = data;
+	va_list ap;
+	void *arg;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	return compr_hw_ops.ioctl(uring_data->hw_data, cmd, arg);
+}
+
+static int compress_uring_get_poll_fd(void *data, short *events)
+{
+	struct compress_uring_data *uring_data = data;
+
+	return compr_hw_ops.get_poll_fd(uring_data->hw_data, events);
+}
+
+static int compress_uring_handle_revents(void *data, short revents,
+		short *events)
+{
+	struct compress_uring_data *uring_data = data;
+
+	return compr_hw_ops.handle_revents(uring_data->hw_data, revents, events);
+}
+
+static void compress_uring_close(void *data)
+{
+	struct compress_uring_data *uring_data = data;
+
+	compr_hw_ops.close(uring_data->hw_data);
+	uring_put(uring_data->uring);
+	free(uring_data);
+}
+
+static int compress_uring_open(unsigned int card, unsigned int device,
+		unsigned int flags, void **data, void *node)
+{
+	struct compress_uring_data *uring_data;
+	int fd;
+
+	uring_data = calloc(1, sizeof(*uring_data));
+	if (!uring_data)
+		return -ENOMEM;
+
+	uring_data->uring = uring_get();
+	if (!uring_data->uring) {
+		free(uring_data);
+		return -1;
+	}
+
+	fd = compr_hw_ops.open(card, device, flags, &uring_data->hw_data, node);
+	if (fd < 0) {
+		uring_put(uring_data->uring);
+		free(uring_data);
+		return fd;
+	}
+
+	uring_data->fd = fd;
+	*data = uring_data;
+
+	return fd;
+}
+
+const struct compress_ops compr_uring_ops = {
+	.open = compress_uring_open,
+	.close = compress_uring_close,
+	.ioctl = compress_uring_ioctl,
+	.read = compress_uring_read,
+	.write = compress_uring_write,
+	.readv = compress_uring_readv,
+	.writev = compress_uring_writev,
+	.poll = compress_uring_poll,
+	.get_poll_fd = compress_uring_get_poll_fd,
+	.handle_revents = compress_uring_handle_revents,
+	.avail = compress_uring_avail,
+	.tstamp = compress_uring_tstamp,
+	.start = compress_uring_start,
+	.stop = compress_uring_stop,
+	.set_params = compress_uring_set_params,
+};
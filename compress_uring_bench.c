@@ -0,0 +1,298 @@
+/* compress_uring_bench.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+/*
+ * Plays the same file through the classic and the io_uring backend and
+ * compares syscalls, CPU time and context switches. Syscalls are counted
+ * with the raw_syscalls:sys_enter tracepoint, which needs tracefs and perf
+ * access (root); otherwise run each backend under strace -c -f.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/perf_event.h>
+#include <linux/types.h>
+#define __force
+#define __bitwise
+#define __user
+#include "sound/compress_params.h"
+#include "tinycompress/tinycompress.h"
+
+struct bench_result {
+	double wall_ms;
+	double user_ms;
+	double sys_ms;
+	long csw;
+	long long syscalls;
+	long long bytes;
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: compress_uring_bench [OPTIONS] filename\n"
+		"-c\tcard number\n"
+		"-d\tdevice node\n"
+		"-b\tbuffer size\n"
+		"-f\tfragments\n"
+		"-I\tcodec id (default MP3)\n"
+		"-r\tsample rate (default 44100)\n"
+		"-C\tchannels (default 2)\n"
+		"-B\tbit rate (default 128000)\n"
+		"-m\tbackend: hw, uring or both (default both)\n"
+		"-h\tPrints this help list\n\n"
+		"Example:\n"
+		"\tcompress_uring_bench -c 0 -d 1 test.mp3\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static int open_syscall_counter(void)
+{
+	static const char * const paths[] = {
+		"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+		"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+	};
+	struct perf_event_attr attr;
+	unsigned long long id;
+	unsigned int i;
+	FILE *f = NULL;
+	int fd;
+
+	for (i = 0; !f && i < sizeof(paths) / sizeof(paths[0]); i++)
+		f = fopen(paths[i], "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%llu", &id) != 1) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.size = sizeof(attr);
+	attr.config = id;
+	attr.disabled = 1;
+	/* count the threads the library creates as well */
+	attr.inherit = 1;
+
+	fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	return fd;
+}
+
+static double tv_ms(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+static int run(const char *name, unsigned int card, unsigned int device,
+		unsigned int flags, struct compr_config *config,
+		struct bench_result *result)
+{
+	struct compress *compress;
+	struct rusage ru_start, ru_end;
+	struct timespec start, end;
+	long long count = 0;
+	int counter, num_read, wrote, ret = -1;
+	bool started = false;
+	char *buffer;
+	FILE *file;
+
+	file = fopen(name, "rb");
+	if (!file) {
+		fprintf(stderr, "Unable to open file '%s'\n", name);
+		return -1;
+	}
+
+	counter = open_syscall_counter();
+	memset(result, 0, sizeof(*result));
+	result->syscalls = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	getrusage(RUSAGE_SELF, &ru_start);
+	if (counter >= 0)
+		ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+
+	compress = compress_open(card, device, COMPRESS_IN | flags, config);
+	if (!compress || !is_compress_ready(compress)) {
+		fprintf(stderr, "Unable to open Compress device %d:%d\n",
+				card, device);
+		fprintf(stderr, "ERR: %s\n", compress_get_error(compress));
+		goto file_exit;
+	}
+
+	buffer = malloc(config->fragment_size);
+	if (!buffer)
+		goto comp_exit;
+
+	while ((num_read = fread(buffer, 1, config->fragment_size, file)) > 0) {
+		wrote = compress_write(compress, buffer, num_read);
+		if (wrote < 0) {
+			fprintf(stderr, "ERR: %s\n", compress_get_error(compress));
+			goto buf_exit;
+		}
+		result->bytes += wrote;
+		/* start once the whole buffer has been filled */
+		if (!started && result->bytes >=
+		    config->fragment_size * config->fragments) {
+			compress_start(compress);
+			started = true;
+		}
+	}
+	if (!started)
+		compress_start(compress);
+	compress_drain(compress);
+	ret = 0;
+
+buf_exit:
+	free(buffer);
+comp_exit:
+	compress_close(compress);
+file_exit:
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counter, &count, sizeof(count)) == sizeof(count))
+			result->syscalls = count;
+		close(counter);
+	}
+	getrusage(RUSAGE_SELF, &ru_end);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fclose(file);
+
+	result->wall_ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+		(end.tv_nsec - start.tv_nsec) / 1000000.0;
+	result->user_ms = tv_ms(&ru_end.ru_utime) - tv_ms(&ru_start.ru_utime);
+	result->sys_ms = tv_ms(&ru_end.ru_stime) - tv_ms(&ru_start.ru_stime);
+	result->csw = (ru_end.ru_nvcsw - ru_start.ru_nvcsw) +
+		(ru_end.ru_nivcsw - ru_start.ru_nivcsw);
+	return ret;
+}
+
+static void print_result(const char *backend, struct bench_result *result)
+{
+	printf("%-6s %12lld %10.1f %10.1f %10.1f %8ld ", backend, result->bytes,
+			result->wall_ms, result->user_ms, result->sys_ms,
+			result->csw);
+	if (result->syscalls >= 0)
+		printf("%10lld\n", result->syscalls);
+	else
+		printf("%10s\n", "n/a");
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_result result;
+	struct compr_config config;
+	struct snd_codec codec;
+	unsigned long buffer_size = 0;
+	unsigned int card = 0, device = 0, frag = 0;
+	const char *mode = "both";
+	char *file;
+	int c;
+
+	memset(&codec, 0, sizeof(codec));
+	codec.id = SND_AUDIOCODEC_MP3;
+	codec.sample_rate = 44100;
+	codec.ch_in = 2;
+	codec.bit_rate = 128000;
+
+	while ((c = getopt(argc, argv, "hb:f:c:d:I:r:C:B:m:")) != -1) {
+		switch (c) {
+		case 'b':
+			buffer_size = strtol(optarg, NULL, 0);
+			break;
+		case 'f':
+			frag = strtol(optarg, NULL, 10);
+			break;
+		case 'c':
+			card = strtol(optarg, NULL, 10);
+			break;
+		case 'd':
+			device = strtol(optarg, NULL, 10);
+			break;
+		case 'I':
+			codec.id = strtol(optarg, NULL, 0);
+			break;
+		case 'r':
+			codec.sample_rate = strtol(optarg, NULL, 10);
+			break;
+		case 'C':
+			codec.ch_in = strtol(optarg, NULL, 10);
+			break;
+		case 'B':
+			codec.bit_rate = strtol(optarg, NULL, 10);
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind >= argc)
+		usage();
+
+	file = argv[optind];
+	codec.ch_out = codec.ch_in;
+
+	printf("%-6s %12s %10s %10s %10s %8s %10s\n", "mode", "bytes",
+			"wall ms", "user ms", "sys ms", "ctxsw", "syscalls");
+
+	if (strcmp(mode, "uring")) {
+		config.fragment_size = frag ? buffer_size / frag : 0;
+		config.fragments = frag;
+		config.codec = &codec;
+		if (run(file, card, device, 0, &config, &result))
+			exit(EXIT_FAILURE);
+		print_result("hw", &result);
+	}
+
+	if (strcmp(mode, "hw")) {
+		config.fragment_size = frag ? buffer_size / frag : 0;
+		config.fragments = frag;
+		config.codec = &codec;
+		if (run(file, card, device, COMPRESS_URING, &config, &result))
+			exit(EXIT_FAILURE);
+		print_result("uring", &result);
+	}
+
+	exit(EXIT_SUCCESS);
+}
@@ -31,6 +31,8 @@
 #ifndef __COMPRESS_PLUGIN_H__
 #define __COMPRESS_PLUGIN_H__
 
+#include <sys/uio.h>
+
 #include "sound/compress_params.h"
 #include "sound/compress_offload.h"
 
@@ -46,8 +48,99 @@
 				unsigned int device,               \
 				unsigned int flags);
 
+/*
+ * Plugin ABI versions. Version 1 plugins provide the compress_plugin_ops
+ * members up to poll and only <name>_open. Version 2 plugins also export
+ * COMPRESS_PLUGIN_GET_FEATURES_FN(name), which is called once when the
+ * library is loaded with the ABI version of the library and returns the
+ * COMPRESS_PLUGIN_FEATURE_* it implements. The library only uses the ops
+ * of the features both sides agree on, the others may be left out.
+ */
+#define COMPRESS_PLUGIN_ABI_VERSION	2
+
+/* writev and readv */
+#define COMPRESS_PLUGIN_FEATURE_IOV		(1 << 0)
+/* get_buffer and commit */
+#define COMPRESS_PLUGIN_FEATURE_RING		(1 << 1)
+/* get_poll_fd */
+#define COMPRESS_PLUGIN_FEATURE_POLL_FD		(1 << 2)
+/* tstamp64 */
+#define COMPRESS_PLUGIN_FEATURE_TSTAMP64	(1 << 3)
+/* set_metadata */
+#define COMPRESS_PLUGIN_FEATURE_METADATA	(1 << 4)
+
+#define COMPRESS_PLUGIN_GET_FEATURES_FN(name)                  \
+	unsigned int name##_get_features(unsigned int version)
+
+#define COMPRESS_PLUGIN_GET_FEATURES_FN_PTR()                  \
+	unsigned int (*plugin_get_features_fn) (unsigned int version);
+
 struct compress_plugin;
 
+/*
+ * struct compress_plugin_tstamp64: timestamp with counters which do not
+ * wrap, fields as in struct snd_compr_tstamp
+ */
+struct compress_plugin_tstamp64 {
+	__u32 byte_offset;
+	__u64 copied_total;
+	__u64 pcm_frames;
+	__u64 pcm_io_frames;
+	__u32 sampling_rate;
+};
+
+/*
+ * compress_plugin_register: register a plugin linked into the process
+ * under the so-name used by the card definition, compress_open() then
+ * uses it instead of loading that library
+ * return 0 on success, negative errno on error
+ */
+int compress_plugin_register(const char *so_name,
+		int (*open_fn) (struct compress_plugin **plugin,
+				unsigned int card,
+				unsigned int device,
+				unsigned int flags));
+
+/*
+ * COMPRESS_PLUGIN_REGISTER: register the plugin defined with
+ * COMPRESS_PLUGIN_OPEN_FN(name) as lib<name>.so when the process starts.
+ * Only active when the plugin is built with -DCOMPRESS_PLUGIN_STATIC,
+ * which must be linked as a whole static library so that the linker
+ * keeps the registration.
+ */
+#ifdef COMPRESS_PLUGIN_STATIC
+#define COMPRESS_PLUGIN_REGISTER(name)                                \
+	static void __attribute__((constructor)) name##_register(void) \
+	{                                                              \
+		compress_plugin_register("lib" #name ".so", name##_open); \
+	}
+#else
+#define COMPRESS_PLUGIN_REGISTER(name)
+#endif
+
+/*
+ * compress_plugin_register_v2: same as compress_plugin_register() for a
+ * version 2 plugin, get_features_fn is its <name>_get_features
+ */
+int compress_plugin_register_v2(const char *so_name,
+		int (*open_fn) (struct compress_plugin **plugin,
+				unsigned int card,
+				unsigned int device,
+				unsigned int flags),
+		unsigned int (*get_features_fn) (unsigned int version));
+
+/* COMPRESS_PLUGIN_REGISTER_V2: COMPRESS_PLUGIN_REGISTER of a version 2 plugin */
+#ifdef COMPRESS_PLUGIN_STATIC
+#define COMPRESS_PLUGIN_REGISTER_V2(name)                             \
+	static void __attribute__((constructor)) name##_register(void) \
+	{                                                              \
+		compress_plugin_register_v2("lib" #name ".so",         \
+				name##_open, name##_get_features);     \
+	}
+#else
+#define COMPRESS_PLUGIN_REGISTER_V2(name)
+#endif
+
 struct compress_plugin_ops {
 	void (*close) (struct compress_plugin *plugin);
 	int (*get_caps) (struct compress_plugin *plugin,
@@ -70,8 +163,49 @@ struct compress_plugin_ops {
 	int (*partial_drain) (struct compress_plugin *plugin);
 	int (*next_track) (struct compress_plugin *plugin);
 	int (*ioctl) (struct compress_plugin *plugin, int cmd, ...);
+	/*
+	 * Like poll(2), report only the events asked for in fds->events.
+	 * The library waits with no events until a wakeup mark is due and
+	 * relies on the timeout, a stop or an error to end that wait.
+	 */
 	int (*poll) (struct compress_plugin *plugin,
 			struct pollfd *fds, nfds_t nfds, int timeout);
+
+	/* Version 2, only used when the matching feature is reported */
+
+	/*
+	 * COMPRESS_PLUGIN_FEATURE_RING, direct ring access: get_buffer
+	 * returns a pointer to the contiguous free space of the ring and its
+	 * size, commit queues the first size bytes of it for the DSP.
+	 */
+	int (*get_buffer) (struct compress_plugin *plugin,
+			void **buf, size_t *size);
+	int (*commit) (struct compress_plugin *plugin, size_t size);
+	/*
+	 * COMPRESS_PLUGIN_FEATURE_IOV, vectored transfers, otherwise
+	 * write/read are called per entry
+	 */
+	int (*writev) (struct compress_plugin *plugin,
+			const struct iovec *iov, int iovcnt);
+	int (*readv) (struct compress_plugin *plugin,
+			const struct iovec *iov, int iovcnt);
+	/*
+	 * COMPRESS_PLUGIN_FEATURE_POLL_FD, eventfd signalled whenever poll
+	 * would report the stream ready, lets the stream join an external
+	 * epoll set. The library reads it to clear it once poll reports it
+	 * readable.
+	 */
+	int (*get_poll_fd) (struct compress_plugin *plugin);
+	/* COMPRESS_PLUGIN_FEATURE_TSTAMP64, timestamp with 64 bit counters */
+	int (*tstamp64) (struct compress_plugin *plugin,
+			struct compress_plugin_tstamp64 *tstamp);
+	/*
+	 * COMPRESS_PLUGIN_FEATURE_METADATA, set count metadata keys at once,
+	 * otherwise ioctl is called with SNDRV_COMPRESS_SET_METADATA per key
+	 */
+	int (*set_metadata) (struct compress_plugin *plugin,
+			const struct snd_compr_metadata *metadata,
+			unsigned int count);
 };
 
 struct compress_plugin {
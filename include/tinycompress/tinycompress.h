@@ -71,6 +71,45 @@ struct compr_config {
 	struct snd_codec *codec;
 };
 
+/* buffer_ms asking for the largest ring the driver allows */
+#define COMPRESS_LATENCY_DEEP_BUFFER	(~0U)
+
+/*
+ * struct compr_latency: latency targets, used by compress_open_latency()
+ * to choose the fragment size and count
+ *
+ * @buffer_ms: audio to keep buffered, 0 for the least the driver allows
+ * and COMPRESS_LATENCY_DEEP_BUFFER for the most
+ * @wakeup_ms: audio consumed between two wakeups, this is the fragment
+ * size. 0 lets tinycompress choose from buffer_ms
+ * @buffered_ms: returns the audio the configured ring buffer holds at the
+ * codec bit rate, 0 when the bit rate is unknown
+ */
+struct compr_latency {
+	unsigned int buffer_ms;
+	unsigned int wakeup_ms;
+	unsigned int buffered_ms;
+};
+
+/*
+ * struct compr_open_req: one stream to open with compress_open_many()
+ *
+ * @card: sound card number
+ * @device: device number
+ * @flags: device flags, as for compress_open()
+ * @config: stream config requested. Returns actual fragment config
+ * @compress: returns the stream, as compress_open() would
+ * @error: returns 0 when the stream was opened, the errno otherwise
+ */
+struct compr_open_req {
+	unsigned int card;
+	unsigned int device;
+	unsigned int flags;
+	struct compr_config *config;
+	struct compress *compress;
+	int error;
+};
+
 struct compr_gapless_mdata {
 	__u32 encoder_delay;
 	__u32 encoder_padding;
@@ -78,9 +117,183 @@ struct compr_gapless_mdata {
 
 #define COMPRESS_OUT        0x20000000
 #define COMPRESS_IN         0x10000000
+/*
+ * Playback only: writes are queued in a lock-free ring and moved to the
+ * device by a library owned feeder thread, so compress_write() never
+ * blocks. Start, drain, partial drain and next track first wait for the
+ * feeder to hand the queued data to the device, stop discards it.
+ */
+#define COMPRESS_FEEDER     0x08000000
+/*
+ * Move data and poll the device through a process wide io_uring instead
+ * of read/write/poll syscalls. SNDRV_COMPRESS_AVAIL and the control
+ * ioctls stay ioctls, avail accounting is enabled to save AVAIL queries.
+ * Falls back to the classic path when io_uring is not available. Has no
+ * effect on plugin devices.
+ */
+#define COMPRESS_URING      0x04000000
+/*
+ * Open the device without configuring it. The config passed to
+ * compress_open() or compress_configure(), which may be called again to
+ * replace it, is sent to the driver on the first transfer or start.
+ */
+#define COMPRESS_DEFER_PARAMS 0x02000000
+
+/*
+ * struct compr_feeder_config: feeder thread config, see
+ * compress_set_feeder_config()
+ *
+ * @ring_size: ring size in bytes, rounded up to a power of two.
+ *	Zero selects twice the device buffer
+ * @sched_policy: scheduler policy of the feeder thread, SCHED_OTHER,
+ *	SCHED_FIFO or SCHED_RR
+ * @sched_priority: priority for SCHED_FIFO and SCHED_RR
+ * @cpu: cpu the feeder thread is bound to, -1 for no affinity
+ */
+struct compr_feeder_config {
+	unsigned int ring_size;
+	int sched_policy;
+	int sched_priority;
+	int cpu;
+};
+
+/*
+ * struct compr_feeder_stats: feeder ring statistics
+ *
+ * @ring_size: ring size in bytes
+ * @occupancy: bytes currently queued
+ * @max_occupancy: highest number of bytes ever queued
+ * @producer_stalls: writes which found the ring too full for all data
+ * @stalled_bytes: bytes which did not fit in the ring
+ * @bytes_fed: bytes moved to the device by the feeder thread
+ */
+struct compr_feeder_stats {
+	unsigned int ring_size;
+	unsigned int occupancy;
+	unsigned int max_occupancy;
+	unsigned long producer_stalls;
+	unsigned long stalled_bytes;
+	unsigned long long bytes_fed;
+};
+
+/*
+ * struct compress_stats: per stream performance counters
+ *
+ * @bytes_written: bytes written to the device
+ * @bytes_read: bytes read from the device
+ * @ioctls: ioctls issued, including SNDRV_COMPRESS_AVAIL
+ * @writes: write calls made to the device, vectored or not
+ * @reads: read calls made to the device, vectored or not
+ * @polls: poll calls made waiting for the device
+ * @short_writes: writes which moved less than requested
+ * @short_reads: reads which moved less than requested
+ * @pause_exits: transfers which stopped early on a paused stream
+ * @poll_timeouts: polls which timed out
+ * @blocked_ns: time spent waiting for the device, in nanoseconds
+ * @max_stall_ns: longest single wait for the device, in nanoseconds
+ */
+struct compress_stats {
+	unsigned long long bytes_written;
+	unsigned long long bytes_read;
+	unsigned long long ioctls;
+	unsigned long long writes;
+	unsigned long long reads;
+	unsigned long long polls;
+	unsigned long long short_writes;
+	unsigned long long short_reads;
+	unsigned long long pause_exits;
+	unsigned long long poll_timeouts;
+	unsigned long long blocked_ns;
+	unsigned long long max_stall_ns;
+};
+
+/*
+ * Latency histograms kept per stream, with log2 buckets in microseconds:
+ * bucket 0 counts samples below 1us and bucket i those in [2^(i-1), 2^i),
+ * the last bucket also counts everything longer.
+ *
+ * COMPRESS_HIST_POLL_WAIT: each poll() waiting for the device
+ * COMPRESS_HIST_WRITE: each compress_write() or compress_writev() call
+ * COMPRESS_HIST_AVAIL: each SNDRV_COMPRESS_AVAIL ioctl
+ */
+#define COMPRESS_HIST_BUCKETS	32
+
+enum compress_hist_type {
+	COMPRESS_HIST_POLL_WAIT,
+	COMPRESS_HIST_WRITE,
+	COMPRESS_HIST_AVAIL,
+	COMPRESS_HIST_MAX,
+};
+
+struct compress_hist {
+	unsigned long long count[COMPRESS_HIST_BUCKETS];
+};
+
+/*
+ * struct compress_pool_stats: stream pool metrics
+ *
+ * @size: streams the pool keeps configured
+ * @idle: streams currently ready in the pool
+ * @hits: acquires served from the pool
+ * @misses: acquires which had to open a stream
+ * @recycled: released streams stopped and put back in the pool
+ * @reopened: released streams which had to be reopened
+ * @acquire_ns: total time spent in compress_pool_acquire()
+ * @acquire_max_ns: longest compress_pool_acquire()
+ */
+struct compress_pool_stats {
+	unsigned int size;
+	unsigned int idle;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long recycled;
+	unsigned long long reopened;
+	unsigned long long acquire_ns;
+	unsigned long long acquire_max_ns;
+};
+
+/*
+ * struct compress_device_info: capabilities of one device and direction
+ *
+ * @card: sound card number
+ * @device: device number
+ * @flags: direction, COMPRESS_IN or COMPRESS_OUT
+ * @plugin: non-zero when the device is backed by a plugin
+ * @min_fragment_size: smallest fragment size supported, in bytes
+ * @max_fragment_size: largest fragment size supported, in bytes
+ * @min_fragments: fewest fragments supported
+ * @max_fragments: most fragments supported
+ * @codecs: supported codecs, bit n set for codec id n
+ */
+struct compress_device_info {
+	unsigned int card;
+	unsigned int device;
+	unsigned int flags;
+	unsigned int plugin;
+	unsigned int min_fragment_size;
+	unsigned int max_fragment_size;
+	unsigned int min_fragments;
+	unsigned int max_fragments;
+	unsigned long long codecs;
+};
+
+/*
+ * struct compress_device_table: devices found by
+ * compress_enumerate_devices(), ordered by card and device
+ *
+ * @num_devices: number of entries
+ * @devices: one entry per device and supported direction
+ */
+struct compress_device_table {
+	unsigned int num_devices;
+	struct compress_device_info devices[];
+};
 
 struct compress;
+struct compress_pool;
 struct snd_compr_tstamp;
+struct iovec;
+struct pollfd;
 
 #ifdef ENABLE_EXTENDED_COMPRESS_FORMAT
 union snd_codec_options;
@@ -96,11 +309,58 @@ struct snd_compr_metadata;
  * @card: sound card number
  * @device: device number
  * @flags: device flags can be COMPRESS_OUT or COMPRESS_IN
- * @config: stream config requested. Returns actual fragment config
+ * @config: stream config requested. Returns actual fragment config. May
+ * be NULL with COMPRESS_DEFER_PARAMS
  */
 struct compress *compress_open(unsigned int card, unsigned int device,
 		unsigned int flags, struct compr_config *config);
 
+/*
+ * compress_open_many: open several streams at once
+ * returns the number of streams opened
+ * The card definitions and plugin libraries are loaded once for all of
+ * them and the devices are opened in parallel, so this takes about as
+ * long as the slowest open. Every entry must be checked on return, the
+ * streams which could be opened stay open when others fail. Use the
+ * error of an entry rather than compress_get_error() of a failed stream,
+ * which is shared by all failed opens.
+ *
+ * @reqs: streams to open
+ * @count: number of entries in reqs
+ */
+int compress_open_many(struct compr_open_req *reqs, unsigned int count);
+
+/*
+ * compress_configure: set the config of a stream opened with
+ * COMPRESS_DEFER_PARAMS
+ * return 0 on success, negative on error, EBUSY once the config was sent
+ * to the driver
+ * The config is checked against the device caps like compress_open()
+ * does and replaces any earlier one.
+ *
+ * @compress: compress stream to be configured
+ * @config: stream config requested. Returns actual fragment config
+ */
+int compress_configure(struct compress *compress, struct compr_config *config);
+
+/*
+ * compress_open_latency: open a new compress stream sized for latency
+ * targets rather than an explicit fragment config
+ * returns the same as compress_open()
+ * The fragment size and count are computed from the codec bit rate and
+ * clamped to the driver limits, any passed in config are ignored.
+ * Millisecond targets need codec->bit_rate to be set.
+ *
+ * @card: sound card number
+ * @device: device number
+ * @flags: device flags can be COMPRESS_OUT or COMPRESS_IN
+ * @config: stream config requested. Returns actual fragment config
+ * @latency: latency targets. Returns the buffered duration
+ */
+struct compress *compress_open_latency(unsigned int card,
+		unsigned int device, unsigned int flags,
+		struct compr_config *config, struct compr_latency *latency);
+
 /*
  * compress_close: close the compress stream
  *
@@ -131,6 +391,13 @@ int compress_get_hpointer(struct compress *compress,
 int compress_get_tstamp(struct compress *compress,
 		unsigned long *samples, unsigned int *sampling_rate);
 
+/*
+ * compress_get_tstamp64: same as compress_get_tstamp() with a 64 bit
+ * sample count, which does not wrap when the backend keeps 64 bit counters
+ */
+int compress_get_tstamp64(struct compress *compress,
+		unsigned long long *samples, unsigned int *sampling_rate);
+
 /*
  * compress_write: write data to the compress stream
  * return bytes written on success, negative on error
@@ -143,6 +410,8 @@ int compress_get_tstamp(struct compress *compress,
  * written. If the return value is not an error and is < size
  * the caller can use compress_wait() to block until the driver
  * is ready for more data.
+ * With COMPRESS_FEEDER the data is queued for the feeder thread and
+ * only as many bytes as fit in its ring are taken, without blocking.
  *
  * @compress: compress stream to be written to
  * @buf: pointer to data
@@ -167,6 +436,65 @@ int compress_write(struct compress *compress, const void *buf, unsigned int size
  */
 int compress_read(struct compress *compress, void *buf, unsigned int size);
 
+/*
+ * compress_writev: write data gathered from several buffers to the
+ * compress stream
+ * return bytes written on success, negative on error
+ * Behaves like compress_write() for the concatenation of all entries, the
+ * available ring space is filled across entries in a single transfer.
+ *
+ * @compress: compress stream to be written to
+ * @iov: array of buffers to be written
+ * @iovcnt: number of entries in iov
+ */
+int compress_writev(struct compress *compress, const struct iovec *iov,
+		int iovcnt);
+
+/*
+ * compress_readv: read data from the compress stream scattered into
+ * several buffers
+ * return bytes read on success, negative on error
+ * Behaves like compress_read() for the concatenation of all entries.
+ *
+ * @compress: compress stream from where data is to be read
+ * @iov: array of buffers to be filled
+ * @iovcnt: number of entries in iov
+ */
+int compress_readv(struct compress *compress, const struct iovec *iov,
+		int iovcnt);
+
+/*
+ * compress_get_buffer: get a buffer to be filled with data for the
+ * compress stream, to be followed by compress_commit()
+ * return 0 on success, negative on error
+ * When the backend supports direct ring access the buffer points into the
+ * ring itself, otherwise into a library owned staging area which is
+ * written out with compress_write() on commit.
+ * By default this call blocks until some space is available. In
+ * non-blocking mode *size can be 0 when the ring is full. A paused stream
+ * also returns with *size set to 0.
+ *
+ * @compress: compress stream to be written to
+ * @buf: returns pointer to the buffer
+ * @size: returns number of bytes that can be filled
+ */
+int compress_get_buffer(struct compress *compress, void **buf,
+		unsigned int *size);
+
+/*
+ * compress_commit: queue data filled in the buffer returned by
+ * compress_get_buffer()
+ * return 0 on success, negative on error
+ * With the staging area fallback, data that could not be written in
+ * non-blocking mode or while paused is kept and written first on the
+ * next commit.
+ *
+ * @compress: compress stream to be written to
+ * @size: number of bytes filled, at most the size returned by
+ *	compress_get_buffer()
+ */
+int compress_commit(struct compress *compress, unsigned int size);
+
 /*
  * compress_start: start the compress stream
  * return 0 on success, negative on error
@@ -256,6 +584,9 @@ int compress_set_next_track_param(struct compress *compress,
 /*
  * is_codec_supported:check if the given codec is supported
  * returns true when supported, false if not
+ * Besides the codec type, the channels, sample rate, bit rate, profile
+ * and format are matched against the codec descriptors of the driver
+ * when it reports them.
  *
  * @card: sound card number
  * @device: device number
@@ -265,6 +596,79 @@ int compress_set_next_track_param(struct compress *compress,
 bool is_codec_supported(unsigned int card, unsigned int device,
 	       unsigned int flags, struct snd_codec *codec);
 
+/*
+ * compress_get_best_codec_config: adjust the properties of codec to the
+ * closest configuration supported by the device, e.g. to the nearest
+ * sample rate and the supported channel count
+ * return 0 on success, negative when the codec type is not supported
+ * Codecs of drivers which don't report codec descriptors are left as is.
+ *
+ * @card: sound card number
+ * @device: device number
+ * @flags: stream flags
+ * @codec: codec to be adjusted
+ */
+int compress_get_best_codec_config(unsigned int card, unsigned int device,
+		unsigned int flags, struct snd_codec *codec);
+
+/*
+ * compress_enumerate_devices: find the compress devices of all cards and
+ * read their capabilities
+ * returns the table, NULL with errno set on error
+ * Kernel devices are found in /dev/snd and plugin devices from the card
+ * definitions. Each device is opened once per direction, spread over a
+ * small pool of threads, and its codec descriptors are loaded in the
+ * capabilities cache so that later is_codec_supported() calls don't open
+ * the device again. Devices which cannot be opened, e.g. because they are
+ * busy, are left out. The table is a single allocation which can be
+ * copied as is.
+ *
+ * @threads: number of threads to use, 0 for the default
+ */
+const struct compress_device_table *compress_enumerate_devices(
+		unsigned int threads);
+
+/* compress_free_device_table: free a table from compress_enumerate_devices() */
+void compress_free_device_table(const struct compress_device_table *table);
+
+/*
+ * Device capabilities are cached per process after the first
+ * is_codec_supported() or compress_open() on a card, device and
+ * direction, later calls answer from the cache without opening the
+ * device again.
+ *
+ * compress_invalidate_caps: drop cached capabilities, e.g. after the DSP
+ * was restarted or its firmware changed. Negative card or device match
+ * all cards or devices.
+ */
+void compress_invalidate_caps(int card, int device);
+
+/*
+ * compress_set_caps_ttl: expire cached capabilities ttl_ms after they
+ * were read from the device. 0, the default, keeps them until
+ * compress_invalidate_caps() is called.
+ */
+void compress_set_caps_ttl(unsigned int ttl_ms);
+
+/*
+ * Plugin libraries are shared by all streams using them. The policy
+ * decides what happens once the last of those streams is closed:
+ *
+ * COMPRESS_PLUGIN_KEEP_RESIDENT: keep the library loaded, so the next open
+ *	skips the dynamic loader (default)
+ * COMPRESS_PLUGIN_UNLOAD_ON_CLOSE: dlclose the library
+ */
+enum compress_plugin_policy {
+	COMPRESS_PLUGIN_KEEP_RESIDENT,
+	COMPRESS_PLUGIN_UNLOAD_ON_CLOSE,
+};
+
+/*
+ * compress_set_plugin_policy: set the plugin unload policy, switching to
+ * COMPRESS_PLUGIN_UNLOAD_ON_CLOSE also unloads the unused libraries
+ */
+void compress_set_plugin_policy(enum compress_plugin_policy policy);
+
 /*
  * compress_set_max_poll_wait: set the maximum time tinycompress
  * will wait for driver to signal a poll(). Interval is in
@@ -278,9 +682,205 @@ void compress_set_max_poll_wait(struct compress *compress, int milliseconds);
 /* Enable or disable non-blocking mode for write and read */
 void compress_nonblock(struct compress *compress, int nonblock);
 
+/*
+ * compress_set_watermarks: set when compress_write() and compress_read()
+ * move data, in bytes buffered in the ring
+ * return 0 on success, negative on error
+ * Playback waits until the buffered data drops to low and then fills the
+ * ring up to high in one write. Capture waits until high bytes are
+ * buffered and then reads down to low. Marks past one fragment away from
+ * the driver wakeup are reached by sleeping based on the codec bit rate
+ * rather than polling once per fragment. Passing 0 for both restores the
+ * default of one fragment. With COMPRESS_FEEDER the feeder thread picks
+ * the new marks up before its next transfer.
+ *
+ * @compress: compress stream to be configured
+ * @low: low watermark in bytes
+ * @high: high watermark in bytes, at most the ring size
+ */
+int compress_set_watermarks(struct compress *compress, unsigned int low,
+		unsigned int high);
+
+/*
+ * compress_set_watermarks_ms: same as compress_set_watermarks() with the
+ * marks given in milliseconds of audio at the codec bit rate
+ */
+int compress_set_watermarks_ms(struct compress *compress,
+		unsigned int low_ms, unsigned int high_ms);
+
+/*
+ * compress_get_wakeups: get the number of times compress_write() and
+ * compress_read() woke up waiting for the device
+ * return 0 on success, negative on error
+ *
+ * @compress: compress stream on which query is made
+ * @wakeups: wakeups since the first one
+ * @per_sec: average wakeups per second since the first one
+ */
+int compress_get_wakeups(struct compress *compress, unsigned long *wakeups,
+		unsigned int *per_sec);
+
+/*
+ * compress_set_avail_accounting: enable or disable local avail accounting.
+ * When enabled, compress_write() and compress_read() keep a local estimate
+ * of the ring buffer space seeded from the last SNDRV_COMPRESS_AVAIL and
+ * only query the driver again when the estimate can't cover the next
+ * transfer. Disabled by default, except with COMPRESS_URING.
+ */
+void compress_set_avail_accounting(struct compress *compress, int enable);
+
+/*
+ * compress_set_feeder_config: configure the feeder thread of a stream
+ * opened with COMPRESS_FEEDER. The thread is created on the first write,
+ * so this must be called before that.
+ * return 0 on success, negative on error
+ *
+ * @compress: compress stream to be configured
+ * @config: feeder ring depth, scheduling and affinity
+ */
+int compress_set_feeder_config(struct compress *compress,
+		const struct compr_feeder_config *config);
+
+/*
+ * compress_get_feeder_stats: get the feeder ring statistics
+ * return 0 on success, negative on error
+ *
+ * @compress: compress stream on which query is made
+ * @stats: returns the statistics
+ */
+int compress_get_feeder_stats(struct compress *compress,
+		struct compr_feeder_stats *stats);
+
+/*
+ * compress_get_avail_accounting: get the avail accounting counters
+ * return 0 on success, negative on error
+ *
+ * @compress: compress stream on which query is made
+ * @queried: number of SNDRV_COMPRESS_AVAIL queries sent to the driver
+ * @avoided: number of queries answered from the local estimate
+ */
+int compress_get_avail_accounting(struct compress *compress,
+		unsigned long *queried, unsigned long *avoided);
+
+/*
+ * compress_get_stats: get the performance counters of a stream
+ * return 0 on success, negative on error
+ * Counters are kept from open, or from the last compress_reset_stats(),
+ * and may be read while another thread uses the stream.
+ *
+ * @compress: compress stream on which query is made
+ * @stats: returns the counters
+ */
+int compress_get_stats(struct compress *compress,
+		struct compress_stats *stats);
+
+/*
+ * compress_reset_stats: clear the performance counters of a stream
+ */
+void compress_reset_stats(struct compress *compress);
+
+/*
+ * compress_get_histogram: get one latency histogram of a stream
+ * return 0 on success, negative on error
+ *
+ * @compress: compress stream on which query is made
+ * @type: histogram to get
+ * @hist: returns the bucket counts
+ */
+int compress_get_histogram(struct compress *compress,
+		enum compress_hist_type type, struct compress_hist *hist);
+
+/*
+ * compress_reset_histograms: clear all latency histograms of a stream
+ */
+void compress_reset_histograms(struct compress *compress);
+
+/*
+ * compress_dump_histograms: print the non empty buckets of all latency
+ * histograms of a stream to fd, e.g. from a dumpsys handler
+ * return 0 on success, negative on error
+ */
+int compress_dump_histograms(struct compress *compress, int fd);
+
+/*
+ * compress_pool_create: open streams ahead of time so that playback can
+ * start without the cost of opening and configuring the device
+ * returns the pool, NULL with errno set on error
+ * Up to size streams are opened and configured like compress_open() does.
+ * Devices allowing fewer streams are not an error as long as one could be
+ * opened.
+ *
+ * @card: sound card number
+ * @device: device number
+ * @flags: stream flags
+ * @config: stream configuration, copied along with its codec
+ * @size: number of streams to keep ready
+ */
+struct compress_pool *compress_pool_create(unsigned int card,
+		unsigned int device, unsigned int flags,
+		const struct compr_config *config, unsigned int size);
+
+/*
+ * compress_pool_destroy: close the streams of the pool and free it, all
+ * acquired streams must have been released
+ */
+void compress_pool_destroy(struct compress_pool *pool);
+
+/*
+ * compress_pool_acquire: take a configured stream from the pool, opening
+ * a new one when the pool is empty
+ * returns the stream, check it with is_compress_ready() as for
+ * compress_open()
+ */
+struct compress *compress_pool_acquire(struct compress_pool *pool);
+
+/*
+ * compress_pool_release: give a stream back to the pool instead of
+ * closing it. A started stream is stopped, which takes it back to its
+ * configured state. A stream written to without being started, or whose
+ * codec parameters changed, is reopened instead. Stream settings such as
+ * non-blocking mode and watermarks are reset.
+ */
+void compress_pool_release(struct compress_pool *pool,
+		struct compress *compress);
+
+/* compress_pool_get_stats: get the pool metrics */
+void compress_pool_get_stats(struct compress_pool *pool,
+		struct compress_pool_stats *stats);
+
 /* Wait for ring buffer to ready for next read or write */
 int compress_wait(struct compress *compress, int timeout_ms);
 
+/*
+ * compress_get_poll_descriptors: get the descriptor to poll for stream
+ * readiness, so the stream can be driven from an external event loop
+ * (poll, epoll) together with compress_nonblock()
+ * returns the number of descriptors filled, negative on error
+ * A stream uses a single descriptor. For plugin streams this is an
+ * eventfd provided by the plugin. Not available with COMPRESS_FEEDER.
+ *
+ * @compress: compress stream to be polled
+ * @pfds: array of descriptors to be filled
+ * @space: number of entries in pfds
+ */
+int compress_get_poll_descriptors(struct compress *compress,
+		struct pollfd *pfds, unsigned int space);
+
+/*
+ * compress_handle_revents: translate what poll reported on the stream
+ * descriptors into stream events
+ * return 0 on success, negative on error
+ * revents is set to POLLOUT (playback) or POLLIN (capture) when the
+ * stream is ready, POLLERR on error and 0 when there is nothing to do.
+ *
+ * @compress: compress stream which was polled
+ * @pfds: descriptors from compress_get_poll_descriptors() after poll
+ * @nfds: number of entries in pfds
+ * @revents: returns the stream events
+ */
+int compress_handle_revents(struct compress *compress, struct pollfd *pfds,
+		unsigned int nfds, unsigned short *revents);
+
 int is_compress_running(struct compress *compress);
 
 int is_compress_ready(struct compress *compress);
@@ -0,0 +1,134 @@
+/* snd_card_def_loopback.c
+**
+** Copyright (c) 2026, The tinycompress Authors. All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above
+**     copyright notice, this list of conditions and the following
+**     disclaimer in the documentation and/or other materials provided
+**     with the distribution.
+**   * Neither the name of the copyright holder nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+** WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+** BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+** OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+** IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**/
+
+/*
+ * Stand-in for the vendor card definition parser, libsndcardparser.so,
+ * for machines without one: every compress device it defines is a
+ * plugin device backed by libcompress_loopback.so. The layout is read
+ * from the environment when a card is first looked up:
+ *   COMPRESS_LOOPBACK_CARDS	cards 0 to n - 1 are defined, default 1
+ *   COMPRESS_LOOPBACK_DEVICES	compress devices per card, default 1
+ *   COMPRESS_LOOPBACK_PLUGIN	plugin library to use instead
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "snd_utils.h"
+
+#define LOOPBACK_MAX_CARDS	8
+#define LOOPBACK_MAX_DEVICES	16
+
+#define LOOPBACK_PLUGIN		"libcompress_loopback.so"
+
+struct loopback_node {
+	unsigned int card;
+	unsigned int device;
+};
+
+struct loopback_card {
+	unsigned int card;
+	struct loopback_node nodes[LOOPBACK_MAX_DEVICES];
+};
+
+static struct loopback_card loopback_cards[LOOPBACK_MAX_CARDS];
+
+static unsigned int loopback_env(const char *name, unsigned int def,
+		unsigned int max)
+{
+	const char *env = getenv(name);
+	unsigned long val;
+
+	if (!env)
+		return def;
+
+	val = strtoul(env, NULL, 0);
+	return val < max ? val : max;
+}
+
+void *snd_card_def_get_card(unsigned int card)
+{
+	if (card >= loopback_env("COMPRESS_LOOPBACK_CARDS", 1,
+				LOOPBACK_MAX_CARDS))
+		return NULL;
+
+	loopback_cards[card].card = card;
+	return &loopback_cards[card];
+}
+
+void snd_card_def_put_card(void *card __unused)
+{
+}
+
+void *snd_card_def_get_node(void *card, unsigned int id, int type)
+{
+	struct loopback_card *loopback_card = card;
+	struct loopback_node *node;
+
+	if (!loopback_card || (type != NODE_COMPRESS))
+		return NULL;
+	if (id >= loopback_env("COMPRESS_LOOPBACK_DEVICES", 1,
+				LOOPBACK_MAX_DEVICES))
+		return NULL;
+
+	node = &loopback_card->nodes[id];
+	node->card = loopback_card->card;
+	node->device = id;
+	return node;
+}
+
+int snd_card_def_get_int(void *node, const char *prop, int *val)
+{
+	if (!node || !prop || !val)
+		return -EINVAL;
+
+	if (!strcmp(prop, "type")) {
+		*val = SND_NODE_TYPE_PLUGIN;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+int snd_card_def_get_str(void *node, const char *prop, char **val)
+{
+	char *plugin;
+
+	if (!node || !prop || !val)
+		return -EINVAL;
+
+	if (!strcmp(prop, "so-name")) {
+		plugin = getenv("COMPRESS_LOOPBACK_PLUGIN");
+		*val = plugin ? plugin : LOOPBACK_PLUGIN;
+		return 0;
+	}
+	return -EINVAL;
+}
@@ -31,6 +31,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 #include "snd_utils.h"
 
 #define SND_DLSYM(h, p, s, err) \
@@ -41,109 +42,225 @@ do {                            \
 		err = -ENODEV;          \
 } while(0)
 
+/* libsndcardparser.so and its entry points, loaded once per process */
+struct snd_card_parser {
+	void *dl_hdl;
+	int failed;
+
+	void* (*get_card) (unsigned int card);
+	void (*put_card) (void *card);
+	void* (*get_node) (void *card, unsigned int id,
+				int type);
+	int (*get_int) (void *node, const char *prop, int *val);
+	int (*get_str) (void *node, const char *prop, char **val);
+};
+
+/*
+ * Parsed card definition. Cards without a definition are cached too, with
+ * a NULL card_node, so they are not parsed again. Unused cards are kept
+ * for the next open and only released when the library is unloaded.
+ */
+struct snd_card_node {
+	struct snd_card_node *next;
+	unsigned int card;
+	int refs;
+
+	void *card_node;
+};
+
+static pthread_mutex_t snd_utils_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct snd_card_parser parser;
+static struct snd_card_node *cards;
+static struct snd_node *nodes;
+
 int snd_utils_get_int(struct snd_node *node, const char *prop, int *val)
 {
-	if (!node || !node->card_node || !node->dev_node)
+	if (!node || !node->dev_node)
 		return SND_NODE_TYPE_HW;
 
-	return node->get_int(node->dev_node, prop, val);
+	return parser.get_int(node->dev_node, prop, val);
 }
 
 int snd_utils_get_str(struct snd_node *node, const char *prop, char **val)
 {
-	if (!node || !node->card_node || !node->dev_node)
+	if (!node || !node->dev_node)
 		return SND_NODE_TYPE_HW;
 
-	return node->get_str(node->dev_node, prop, val);
+	return parser.get_str(node->dev_node, prop, val);
 }
 
 void snd_utils_put_dev_node(struct snd_node *node)
 {
+	struct snd_node **link;
+
 	if (!node)
 		return;
 
-	if (node->card_node)
-		node->put_card(node->card_node);
-
-	if (node->dl_hdl)
-		dlclose(node->dl_hdl);
-
-	free(node);
+	pthread_mutex_lock(&snd_utils_lock);
+	if (--node->refs == 0) {
+		for (link = &nodes; *link != node; link = &(*link)->next)
+			;
+		*link = node->next;
+		node->card->refs--;
+		free(node);
+	}
+	pthread_mutex_unlock(&snd_utils_lock);
 }
 
 enum snd_node_type snd_utils_get_node_type(struct snd_node *node)
 {
 	int val = SND_NODE_TYPE_HW;
 
-	if (!node || !node->card_node || !node->dev_node)
+	if (!node || !node->dev_node)
 		return SND_NODE_TYPE_HW;
 
-	node->get_int(node->dev_node, "type", &val);
+	parser.get_int(node->dev_node, "type", &val);
 
 	return val;
 };
 
 
-static int snd_utils_resolve_symbols(struct snd_node *node)
+static int snd_utils_resolve_symbols(struct snd_card_parser *parser)
 {
-	void *dl = node->dl_hdl;
+	void *dl = parser->dl_hdl;
 	int err;
 
-	SND_DLSYM(dl, node->get_card, "snd_card_def_get_card", err);
+	SND_DLSYM(dl, parser->get_card, "snd_card_def_get_card", err);
 	if (err)
 		goto done;
-	SND_DLSYM(dl, node->put_card, "snd_card_def_put_card", err);
+	SND_DLSYM(dl, parser->put_card, "snd_card_def_put_card", err);
 	if (err)
 		goto done;
-	SND_DLSYM(dl, node->get_node, "snd_card_def_get_node", err);
+	SND_DLSYM(dl, parser->get_node, "snd_card_def_get_node", err);
 	if (err)
 		goto done;
-	SND_DLSYM(dl, node->get_int, "snd_card_def_get_int", err);
+	SND_DLSYM(dl, parser->get_int, "snd_card_def_get_int", err);
 	if (err)
 		goto done;
-	SND_DLSYM(dl, node->get_str, "snd_card_def_get_str", err);
+	SND_DLSYM(dl, parser->get_str, "snd_card_def_get_str", err);
 
 done:
 	return err;
 }
 
+/* Called with snd_utils_lock held, a missing parser is not retried */
+static int snd_utils_load_parser(void)
+{
+	if (parser.dl_hdl)
+		return 0;
+	if (parser.failed)
+		return -ENODEV;
+
+	parser.dl_hdl = dlopen("libsndcardparser.so", RTLD_NOW);
+	if (!parser.dl_hdl)
+		goto err_dl_open;
+
+	if (snd_utils_resolve_symbols(&parser) < 0)
+		goto err_resolve_symbols;
+
+	return 0;
+
+err_resolve_symbols:
+	dlclose(parser.dl_hdl);
+	parser.dl_hdl = NULL;
+
+err_dl_open:
+	parser.failed = 1;
+	return -ENODEV;
+}
+
+/* Called with snd_utils_lock held */
+static struct snd_card_node *snd_utils_get_card(unsigned int card)
+{
+	struct snd_card_node *card_node;
+
+	for (card_node = cards; card_node; card_node = card_node->next) {
+		if (card_node->card == card)
+			return card_node;
+	}
+
+	card_node = calloc(1, sizeof(*card_node));
+	if (!card_node)
+		return NULL;
+
+	card_node->card = card;
+	card_node->card_node = parser.get_card(card);
+	card_node->next = cards;
+	cards = card_node;
+	return card_node;
+}
+
 struct snd_node *snd_utils_get_dev_node(unsigned int card,
 		unsigned int device, int dev_type)
 {
+	struct snd_card_node *card_node;
 	struct snd_node *node;
-	int rc = 0;
 
-	node = calloc(1, sizeof(*node));
-	if (!node)
-		return NULL;
+	pthread_mutex_lock(&snd_utils_lock);
 
-	node->dl_hdl = dlopen("libsndcardparser.so", RTLD_NOW);
-	if (!node->dl_hdl) {
-		goto err_dl_open;
+	for (node = nodes; node; node = node->next) {
+		if ((node->card->card == card) && (node->device == device) &&
+		    (node->dev_type == dev_type)) {
+			node->refs++;
+			goto done;
+		}
 	}
 
-	rc = snd_utils_resolve_symbols(node);
-	if (rc < 0)
-		goto err_resolve_symbols;
+	if (snd_utils_load_parser())
+		goto done;
 
-	node->card_node = node->get_card(card);
-	if (!node->card_node)
-		goto err_resolve_symbols;
+	card_node = snd_utils_get_card(card);
+	if (!card_node || !card_node->card_node)
+		goto done;
 
-	node->dev_node = node->get_node(node->card_node,
+	node = calloc(1, sizeof(*node));
+	if (!node)
+		goto done;
+
+	node->dev_node = parser.get_node(card_node->card_node,
 					device, dev_type);
-	if (!node->dev_node)
-		goto err_get_node;
+	if (!node->dev_node) {
+		free(node);
+		node = NULL;
+		goto done;
+	}
+
+	node->card = card_node;
+	node->device = device;
+	node->dev_type = dev_type;
+	node->refs = 1;
+	node->next = nodes;
+	nodes = node;
+	card_node->refs++;
 
+done:
+	pthread_mutex_unlock(&snd_utils_lock);
 	return node;
+}
 
-err_get_node:
-	node->put_card(node->card_node);
+/* Release the parsed cards and the parser when the library is unloaded */
+static void __attribute__((destructor)) snd_utils_release(void)
+{
+	struct snd_card_node **link, *card_node;
 
-err_resolve_symbols:
-	dlclose(node->dl_hdl);
+	if (!parser.dl_hdl)
+		return;
 
-err_dl_open:
-	free(node);
-	return NULL;
+	link = &cards;
+	while ((card_node = *link)) {
+		/* cards with open streams are left to the process exit */
+		if (card_node->refs) {
+			link = &card_node->next;
+			continue;
+		}
+		*link = card_node->next;
+		if (card_node->card_node)
+			parser.put_card(card_node->card_node);
+		free(card_node);
+	}
+
+	if (!cards) {
+		dlclose(parser.dl_hdl);
+		parser.dl_hdl = NULL;
+	}
 }
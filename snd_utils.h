@@ -33,17 +33,19 @@
 
 #include <dlfcn.h>
 
+/*
+ * Handle on a device node of a parsed card definition. Handles are shared
+ * and refcounted per card, device and type, and the parsed cards and the
+ * parser library stay loaded for the life of the process.
+ */
 struct snd_node {
-	void *card_node;
-	void *dev_node;
-	void *dl_hdl;
+	struct snd_node *next;
+	struct snd_card_node *card;
+	unsigned int device;
+	int dev_type;
+	int refs;
 
-	void* (*get_card) (unsigned int card);
-	void (*put_card) (void *card);
-	void* (*get_node) (void *card, unsigned int id,
-				int type);
-	int (*get_int) (void *node, const char *prop, int *val);
-	int (*get_str) (void *node, const char *prop, char **val);
+	void *dev_node;
 };
 
 enum {
@@ -58,6 +60,29 @@ enum snd_node_type {
 	SND_NODE_TYPE_INVALID,
 };
 
+#ifdef COMPRESS_HW_ONLY
+#include <stddef.h>
+
+/* Builds without card definitions, every device is a kernel device */
+static inline struct snd_node *snd_utils_get_dev_node(
+		unsigned int card __attribute__((unused)),
+		unsigned int device __attribute__((unused)),
+		int dev_type __attribute__((unused)))
+{
+	return NULL;
+}
+
+static inline void snd_utils_put_dev_node(
+		struct snd_node *node __attribute__((unused)))
+{
+}
+
+static inline enum snd_node_type snd_utils_get_node_type(
+		struct snd_node *node __attribute__((unused)))
+{
+	return SND_NODE_TYPE_HW;
+}
+#else
 struct snd_node *snd_utils_get_dev_node(unsigned int card,
 		unsigned int device, int dev_type);
 
@@ -68,5 +93,6 @@ enum snd_node_type snd_utils_get_node_type(struct snd_node *node);
 int snd_utils_get_int(struct snd_node *node, const char *prop, int *val);
 
 int snd_utils_get_str(struct snd_node *node, const char *prop, char **val);
+#endif
 
 #endif /* end of __SND_CARD_UTILS_H__ */